@@ -0,0 +1,188 @@
+/*
+ * Fade To Black engine rewrite
+ * Copyright (C) 2006-2012 Gregory Montoir (cyx@users.sourceforge.net)
+ */
+
+#include <EGL/egl.h>
+#include <EGL/eglext.h>
+#include "util.h"
+#include "render.h"
+#include "stub.h"
+
+const char *g_caption = "Fade2Black/OpenGL Benchmark";
+
+static const char *USAGE =
+	"Fade2Black/OpenGL Benchmark\n"
+	"Usage: f2bgl-bench [OPTIONS]...\n"
+	"  --ticks=NUM                 Stop after NUM ticks (default 100000)\n"
+	"  --extra-ticks=NUM           Ticks to run once the demo inputs are consumed (default 0)\n"
+	"  All other options are forwarded to the engine, '--playdemo' and '--render=NULL'\n"
+	"  are implied. With '--render=GL' or '--render=GLSL', an offscreen EGL context\n"
+	"  is created, this works without a GPU with Mesa llvmpipe.\n";
+
+static const int kTickDuration = 40;
+static const int kMaxArgs = 32;
+static const int kLevelsCount = 16;
+
+static int compareSamples(const void *a, const void *b) {
+	const uint64_t va = *(const uint64_t *)a;
+	const uint64_t vb = *(const uint64_t *)b;
+	return (va < vb) ? -1 : (va > vb) ? 1 : 0;
+}
+
+static bool initOffscreenGL(int w, int h) {
+	EGLDisplay display = eglGetDisplay(EGL_DEFAULT_DISPLAY);
+	EGLint major, minor;
+	if (!eglInitialize(display, &major, &minor)) {
+		// no window system, use the Mesa surfaceless platform
+		PFNEGLGETPLATFORMDISPLAYEXTPROC getPlatformDisplay = (PFNEGLGETPLATFORMDISPLAYEXTPROC)eglGetProcAddress("eglGetPlatformDisplayEXT");
+		if (!getPlatformDisplay) {
+			return false;
+		}
+		display = getPlatformDisplay(EGL_PLATFORM_SURFACELESS_MESA, EGL_DEFAULT_DISPLAY, 0);
+		if (!eglInitialize(display, &major, &minor)) {
+			return false;
+		}
+	}
+	static const EGLint configAttribs[] = {
+		EGL_SURFACE_TYPE, EGL_PBUFFER_BIT,
+		EGL_RENDERABLE_TYPE, EGL_OPENGL_BIT,
+		EGL_RED_SIZE, 8,
+		EGL_GREEN_SIZE, 8,
+		EGL_BLUE_SIZE, 8,
+		EGL_DEPTH_SIZE, 16,
+		EGL_NONE
+	};
+	EGLConfig config;
+	EGLint configsCount;
+	if (!eglChooseConfig(display, configAttribs, &config, 1, &configsCount) || configsCount == 0) {
+		return false;
+	}
+	const EGLint surfaceAttribs[] = { EGL_WIDTH, w, EGL_HEIGHT, h, EGL_NONE };
+	EGLSurface surface = eglCreatePbufferSurface(display, config, surfaceAttribs);
+	eglBindAPI(EGL_OPENGL_API);
+	EGLContext context = eglCreateContext(display, config, EGL_NO_CONTEXT, 0);
+	if (surface == EGL_NO_SURFACE || context == EGL_NO_CONTEXT) {
+		return false;
+	}
+	return eglMakeCurrent(display, surface, surface, context);
+}
+
+struct BenchLevelStats {
+	int ticks;
+	uint64_t totalNs;
+	uint64_t maxNs;
+};
+
+int main(int argc, char *argv[]) {
+	int maxTicks = 100000;
+	int extraTicks = 0;
+	bool renderGL = false;
+	char *stubArgv[kMaxArgs];
+	int stubArgc = 0;
+	stubArgv[stubArgc++] = argv[0];
+	stubArgv[stubArgc++] = (char *)"--playdemo";
+	stubArgv[stubArgc++] = (char *)"--render=NULL";
+	for (int i = 1; i < argc; ++i) {
+		if (strncmp(argv[i], "--ticks=", 8) == 0) {
+			maxTicks = atoi(argv[i] + 8);
+			if (maxTicks <= 0) {
+				printf("%s\n", USAGE);
+				return -1;
+			}
+		} else if (strncmp(argv[i], "--extra-ticks=", 14) == 0) {
+			extraTicks = atoi(argv[i] + 14);
+			if (extraTicks < 0) {
+				printf("%s\n", USAGE);
+				return -1;
+			}
+		} else if (strcmp(argv[i], "--help") == 0 || stubArgc >= kMaxArgs - 1) {
+			printf("%s\n", USAGE);
+			return -1;
+		} else {
+			if (strncmp(argv[i], "--render=", 9) == 0) {
+				// the GL backends are only used once a context is current
+				const int backend = Render_parseBackend(argv[i] + 9);
+				if (backend < 0) {
+					printf("%s\n", USAGE);
+					return -1;
+				}
+				renderGL = (backend == kRenderGL || backend == kRenderGLSL);
+			}
+			stubArgv[stubArgc++] = argv[i];
+		}
+	}
+	stubArgv[stubArgc] = 0;
+
+	if (renderGL && !initOffscreenGL(320, 240)) {
+		warning("Unable to create an offscreen GL context");
+		return -1;
+	}
+
+	GameStub *stub = GameStub_create();
+	if (!stub) {
+		return -1;
+	}
+	const int ret = stub->init(stubArgc, stubArgv);
+	if (ret != 0) {
+		return ret;
+	}
+	stub->initGL(320, 240);
+
+	uint64_t *samples = (uint64_t *)malloc(maxTicks * sizeof(uint64_t));
+	if (!samples) {
+		error("Unable to allocate %d tick samples", maxTicks);
+	}
+	BenchLevelStats levels[kLevelsCount];
+	memset(levels, 0, sizeof(levels));
+
+	unsigned int ticks = 0;
+	int count = 0;
+	int extra = extraTicks;
+	const uint64_t startNs = getTimeNs();
+	while (count < maxTicks) {
+		if (!stub->hasDemoInput()) {
+			if (extra <= 0) {
+				break;
+			}
+			--extra;
+		}
+		const int level = stub->getLevel();
+		const uint64_t t0 = getTimeNs();
+		stub->doTick(ticks);
+		stub->drawGL();
+		const uint64_t dt = getTimeNs() - t0;
+		samples[count++] = dt;
+		if (level >= 0 && level < kLevelsCount) {
+			BenchLevelStats *ls = &levels[level];
+			++ls->ticks;
+			ls->totalNs += dt;
+			ls->maxNs = MAX(ls->maxNs, dt);
+		}
+		ticks += kTickDuration;
+	}
+	const uint64_t totalNs = getTimeNs() - startNs;
+	stub->quit();
+
+	if (count == 0) {
+		warning("No tick executed, check the demo files are present");
+		free(samples);
+		return -1;
+	}
+	uint64_t sumNs = 0;
+	for (int i = 0; i < count; ++i) {
+		sumNs += samples[i];
+	}
+	qsort(samples, count, sizeof(uint64_t), compareSamples);
+	const int p99 = MIN(count - 1, count * 99 / 100);
+	printf("ticks %d time %.3f s ticks/sec %.1f\n", count, totalNs / 1e9, count * 1e9 / totalNs);
+	printf("tick min %.3f ms avg %.3f ms p99 %.3f ms max %.3f ms\n", samples[0] / 1e6, sumNs / 1e6 / count, samples[p99] / 1e6, samples[count - 1] / 1e6);
+	for (int i = 0; i < kLevelsCount; ++i) {
+		const BenchLevelStats *ls = &levels[i];
+		if (ls->ticks != 0) {
+			printf("level %2d ticks %6d total %9.3f ms avg %.3f ms max %.3f ms\n", i, ls->ticks, ls->totalNs / 1e6, ls->totalNs / 1e6 / ls->ticks, ls->maxNs / 1e6);
+		}
+	}
+	free(samples);
+	return 0;
+}
@@ -0,0 +1,494 @@
+/*
+ * Fade To Black engine rewrite
+ * Copyright (C) 2006-2012 Gregory Montoir (cyx@users.sourceforge.net)
+ */
+
+#include "decoder.h"
+#include "frustum.h"
+#include "particles.h"
+#include "scaler.h"
+
+const char *g_caption = "Fade2Black/OpenGL Kernels Benchmark";
+
+static const char *USAGE =
+	"Fade2Black/OpenGL Kernels Benchmark\n"
+	"Usage: f2bgl-bench-kernels [OPTIONS]...\n"
+	"  --time=MS                   Minimum duration of each benchmark (default 250)\n"
+	"  --cin=FILE                  Also decode the frames of a .CIN cutscene\n"
+	"  --snd=FILE                  Also decode a compressed .SND file\n";
+
+static const int kFrameW = 320;
+static const int kFrameH = 200;
+static const int kFrameSize = kFrameW * kFrameH;
+
+static int _minDurationMs = 250;
+
+static uint32_t _randSeed = 0x12345678;
+
+static uint32_t nextRand() {
+	_randSeed = _randSeed * 1103515245 + 12345;
+	return _randSeed >> 16;
+}
+
+static void printResult(const char *name, const char *unit, uint64_t count, uint64_t ns) {
+	if (unit) {
+		printf("%-24s %10.1f M/s  %8.3f ns/%s\n", name, count * 1000. / ns, (double)ns / count, unit);
+	} else {
+		printf("%-24s %10.1f MB/s %8.3f ns/byte\n", name, count * 1000. / ns, (double)ns / count);
+	}
+}
+
+// the throughput is expressed in bytes written by the kernel, or in items
+// processed if 'unit' is set
+struct Kernel {
+	const char *name;
+	const char *unit;
+	int outputSize;
+
+	Kernel()
+		: name(0), unit(0), outputSize(0) {
+	}
+	virtual ~Kernel() {}
+	virtual void run() = 0;
+
+	void bench() {
+		run(); // warm up
+		uint64_t count = 0;
+		const uint64_t startNs = getTimeNs();
+		uint64_t ns;
+		do {
+			for (int i = 0; i < 16; ++i) {
+				run();
+			}
+			count += outputSize * 16;
+			ns = getTimeNs() - startNs;
+		} while (ns < (uint64_t)_minDurationMs * 1000000);
+		printResult(name, unit, count, ns);
+	}
+};
+
+struct KernelLZSS : Kernel {
+	uint8_t *_src, *_dst;
+
+	KernelLZSS() {
+		name = "decodeLZSS";
+		outputSize = kFrameSize;
+		_src = ALLOC<uint8_t>(kFrameSize * 2);
+		_dst = ALLOC<uint8_t>(kFrameSize);
+		// literals and back references of 2..17 bytes, about half of each
+		uint8_t *p = _src;
+		int size = 0;
+		while (size < kFrameSize) {
+			uint8_t *code = p++;
+			*code = 0;
+			for (int bit = 0; bit < 8 && size < kFrameSize; ++bit) {
+				const int len = 2 + (nextRand() & 15);
+				if (size < 256 || (nextRand() & 1) || size + len > kFrameSize) {
+					*code |= 1 << bit;
+					*p++ = nextRand();
+					++size;
+				} else {
+					const int offset = nextRand() & 255;
+					*p++ = (offset << 4) | (len - 2);
+					*p++ = offset >> 4;
+					size += len;
+				}
+			}
+		}
+	}
+	~KernelLZSS() {
+		free(_src);
+		free(_dst);
+	}
+	void run() {
+		decodeLZSS(_src, _dst, outputSize);
+	}
+};
+
+struct KernelHuffman : Kernel {
+	uint8_t *_src, *_dst;
+	int _srcSize;
+
+	KernelHuffman() {
+		name = "decodeHuffman";
+		_srcSize = kFrameSize / 2;
+		_src = ALLOC<uint8_t>(_srcSize + 16);
+		_dst = ALLOC<uint8_t>(_srcSize * 2 + 16);
+		// 15 bytes codes table followed by random codes, 1 in 16 escapes to a literal
+		for (int i = 0; i < _srcSize; ++i) {
+			_src[i] = nextRand();
+		}
+		outputSize = decodeHuffman(_src, _srcSize, _dst);
+	}
+	~KernelHuffman() {
+		free(_src);
+		free(_dst);
+	}
+	void run() {
+		decodeHuffman(_src, _srcSize, _dst);
+	}
+};
+
+struct KernelRLE : Kernel {
+	uint8_t *_src, *_dst;
+	int _srcSize;
+
+	KernelRLE() {
+		name = "decodeRLE";
+		outputSize = kFrameSize;
+		_src = ALLOC<uint8_t>(kFrameSize * 2);
+		_dst = ALLOC<uint8_t>(kFrameSize);
+		uint8_t *p = _src;
+		int size = 0;
+		while (size < kFrameSize) {
+			const int len = MIN(1 + (int)(nextRand() & 31), kFrameSize - size);
+			if (nextRand() & 1) {
+				*p++ = 0x7F + len;
+				*p++ = nextRand();
+			} else {
+				*p++ = len - 1;
+				for (int i = 0; i < len; ++i) {
+					*p++ = nextRand();
+				}
+			}
+			size += len;
+		}
+		_srcSize = p - _src;
+	}
+	~KernelRLE() {
+		free(_src);
+		free(_dst);
+	}
+	void run() {
+		decodeRLE(_src, _srcSize, _dst);
+	}
+};
+
+struct KernelADD : Kernel {
+	uint8_t *_src, *_dst;
+
+	KernelADD() {
+		name = "decodeADD";
+		outputSize = kFrameSize;
+		_src = ALLOC<uint8_t>(kFrameSize);
+		_dst = ALLOC<uint8_t>(kFrameSize);
+		for (int i = 0; i < kFrameSize; ++i) {
+			_src[i] = nextRand();
+		}
+	}
+	~KernelADD() {
+		free(_src);
+		free(_dst);
+	}
+	void run() {
+		decodeADD(_src, outputSize, _dst);
+	}
+};
+
+struct KernelDelta16 : Kernel {
+	uint8_t *_src;
+	int16_t *_dst;
+	int _srcSize;
+
+	KernelDelta16(const uint8_t *data = 0, int dataSize = 0) {
+		name = data ? "Delta16Decoder (snd)" : "Delta16Decoder";
+		_srcSize = data ? dataSize : 22050;
+		_src = ALLOC<uint8_t>(_srcSize);
+		_dst = ALLOC<int16_t>(_srcSize);
+		for (int i = 0; i < _srcSize; ++i) {
+			_src[i] = data ? data[i] : nextRand();
+		}
+		outputSize = _srcSize * sizeof(int16_t);
+	}
+	~KernelDelta16() {
+		free(_src);
+		free(_dst);
+	}
+	void run() {
+		Delta16Decoder decoder;
+		for (int i = 0; i < _srcSize; ++i) {
+			_dst[i] = decoder.decode(_src[i]);
+		}
+	}
+};
+
+typedef void (*ScaleProc)(uint16_t *dst, int dstPitch, const uint16_t *src, int srcPitch, int w, int h);
+
+struct KernelScaler : Kernel {
+	ScaleProc _proc;
+	int _factor;
+	uint16_t *_src, *_dst;
+
+	KernelScaler(const char *n, ScaleProc proc, int factor)
+		: _proc(proc), _factor(factor) {
+		name = n;
+		outputSize = kFrameSize * factor * factor * sizeof(uint16_t);
+		_src = ALLOC<uint16_t>(kFrameSize);
+		_dst = ALLOC<uint16_t>(kFrameSize * factor * factor);
+		// 4x4 blocks of solid colors, edges trigger the scaleNx interpolation
+		for (int y = 0; y < kFrameH; ++y) {
+			for (int x = 0; x < kFrameW; ++x) {
+				_src[y * kFrameW + x] = ((x >> 2) * 31 + (y >> 2) * 17) & 7;
+			}
+		}
+	}
+	~KernelScaler() {
+		free(_src);
+		free(_dst);
+	}
+	void run() {
+		_proc(_dst, kFrameW * _factor, _src, kFrameW, kFrameW, kFrameH);
+	}
+};
+
+// the 64x64 cells of a level map against a 90 degrees frustum looking along z
+// from the middle of the map, timed per box or point
+struct KernelFrustum : Kernel {
+	bool _points;
+	FrustumPlanes _planes;
+	FrustumBoxes _boxes[kFrustrumBatchSize];
+	uint8_t _results[kFrustrumBatchSize * kFrustrumBatchSize];
+
+	KernelFrustum(bool points)
+		: _points(points) {
+		name = points ? "Frustum_testPoints" : "Frustum_testBoxes";
+		unit = points ? "point" : "box";
+		outputSize = kFrustrumBatchSize * kFrustrumBatchSize;
+		static const Vertex4f planes[kFrustrumPlanesCount] = {
+			{ -1,  0,  1,     0 },
+			{  1,  0,  1, -1024 },
+			{  0, -1,  1,  -480 },
+			{  0,  1,  1,  -544 },
+			{  0,  0, -1,  1536 },
+			{  0,  0,  1,  -513 }
+		};
+		Frustum_setPlanes(&_planes, planes);
+		for (int x = 0; x < kFrustrumBatchSize; ++x) {
+			FrustumBoxes *boxes = &_boxes[x];
+			boxes->count = kFrustrumBatchSize;
+			for (int z = 0; z < kFrustrumBatchSize; ++z) {
+				boxes->minX[z] = x * 16;
+				boxes->minY[z] = 0;
+				boxes->minZ[z] = z * 16;
+				boxes->maxX[z] = (x + 1) * 16;
+				boxes->maxY[z] = 64;
+				boxes->maxZ[z] = (z + 1) * 16;
+			}
+		}
+	}
+	void run() {
+		for (int x = 0; x < kFrustrumBatchSize; ++x) {
+			const FrustumBoxes *boxes = &_boxes[x];
+			uint8_t *results = &_results[x * kFrustrumBatchSize];
+			if (_points) {
+				Frustum_testPoints(&_planes, boxes->minX, boxes->maxY, boxes->minZ, boxes->count, results);
+			} else {
+				Frustum_testBoxes(&_planes, boxes, results);
+			}
+		}
+	}
+};
+
+// a full table of particles falling and bouncing on the ground, none expire,
+// timed per particle
+struct KernelParticles : Kernel {
+	ParticlesTable _particles;
+
+	KernelParticles() {
+		name = "Particles_update";
+		unit = "particle";
+		outputSize = kParticlesTableSize;
+		_particles.count = kParticlesTableSize;
+		for (int i = 0; i < kParticlesTableSize; ++i) {
+			_particles.xPos[i] = nextRand() << 8;
+			_particles.yPos[i] = (nextRand() & 0x1FFF) << 8;
+			_particles.zPos[i] = nextRand() << 8;
+			_particles.dx[i] = (int16_t)nextRand();
+			_particles.dy[i] = (int16_t)nextRand();
+			_particles.dz[i] = (int16_t)nextRand();
+			_particles.fl[i] = 0;
+			_particles.ticks[i] = 0x7FFF;
+			_particles.speed[i] = 0;
+		}
+	}
+	void run() {
+		Particles_update(&_particles, 64 << 15);
+		for (int i = 0; i < kParticlesTableSize; ++i) {
+			_particles.ticks[i] = 0x7FFF;
+		}
+	}
+};
+
+static uint8_t *readFile(const char *path, int *size) {
+	FILE *fp = fopen(path, "rb");
+	if (!fp) {
+		warning("Unable to open '%s'", path);
+		return 0;
+	}
+	fseek(fp, 0, SEEK_END);
+	*size = ftell(fp);
+	fseek(fp, 0, SEEK_SET);
+	uint8_t *buf = (uint8_t *)malloc(*size);
+	if (buf && fread(buf, 1, *size, fp) != (size_t)*size) {
+		free(buf);
+		buf = 0;
+	}
+	fclose(fp);
+	return buf;
+}
+
+enum {
+	kCinKernelLZSS = 0,
+	kCinKernelHuffman,
+	kCinKernelRLE,
+	kCinKernelADD,
+	kCinKernelsCount
+};
+
+static void benchCutscene(const char *path) {
+	int dataSize;
+	uint8_t *data = readFile(path, &dataSize);
+	if (!data) {
+		return;
+	}
+	static const char *names[] = { "decodeLZSS (cin)", "decodeHuffman (cin)", "decodeRLE (cin)", "decodeADD (cin)" };
+	uint64_t bytes[kCinKernelsCount];
+	uint64_t ns[kCinKernelsCount];
+	memset(bytes, 0, sizeof(bytes));
+	memset(ns, 0, sizeof(ns));
+	const uint8_t *end = data + dataSize;
+	const uint8_t *p = data;
+	if (dataSize < 20 || (READ_LE_UINT32(p) >> 16) != 0x55AA) {
+		warning("Invalid cutscene header '%s'", path);
+		free(data);
+		return;
+	}
+	const uint32_t frameSize = READ_LE_UINT32(p + 4);
+	p += 20;
+	uint8_t *frameBuffers[3];
+	for (int i = 0; i < 3; ++i) {
+		frameBuffers[i] = ALLOC<uint8_t>(frameSize);
+	}
+	int framesCount = 0;
+	while (p + 16 <= end && READ_LE_UINT32(p + 12) == 0xAA55AA55) {
+		const int videoFrameType = p[0];
+		int palColorsCount = (int16_t)READ_LE_UINT16(p + 2);
+		const int palType = (palColorsCount < 0) ? 1 : 0;
+		palColorsCount = ABS(palColorsCount);
+		const uint32_t videoFrameSize = READ_LE_UINT32(p + 4);
+		const uint32_t soundFrameSize = READ_LE_UINT32(p + 8);
+		p += 16;
+		const uint8_t *frameData = p + (palType + 3) * palColorsCount;
+		p = frameData + videoFrameSize + soundFrameSize;
+		if (p > end) {
+			break;
+		}
+		// same sequences as Cutscene::decodeImage
+		uint64_t t0, t1;
+		int size;
+		switch (videoFrameType) {
+		case 9:
+		case 34:
+			t0 = getTimeNs();
+			decodeRLE(frameData, videoFrameSize, frameBuffers[0]);
+			ns[kCinKernelRLE] += getTimeNs() - t0;
+			bytes[kCinKernelRLE] += frameSize;
+			break;
+		case 35:
+		case 36:
+			t0 = getTimeNs();
+			size = decodeHuffman(frameData, videoFrameSize, frameBuffers[2]);
+			t1 = getTimeNs();
+			decodeRLE(frameBuffers[2], (videoFrameType == 35) ? videoFrameSize : size, frameBuffers[0]);
+			ns[kCinKernelHuffman] += t1 - t0;
+			bytes[kCinKernelHuffman] += size;
+			ns[kCinKernelRLE] += getTimeNs() - t1;
+			bytes[kCinKernelRLE] += frameSize;
+			break;
+		case 37:
+			t0 = getTimeNs();
+			size = decodeHuffman(frameData, videoFrameSize, frameBuffers[0]);
+			ns[kCinKernelHuffman] += getTimeNs() - t0;
+			bytes[kCinKernelHuffman] += size;
+			break;
+		case 38:
+		case 39:
+			t0 = getTimeNs();
+			decodeLZSS(frameData, frameBuffers[0], frameSize);
+			ns[kCinKernelLZSS] += getTimeNs() - t0;
+			bytes[kCinKernelLZSS] += frameSize;
+			break;
+		}
+		switch (videoFrameType) {
+		case 34:
+		case 36:
+		case 39:
+			t0 = getTimeNs();
+			decodeADD(frameBuffers[1], frameSize, frameBuffers[0]);
+			ns[kCinKernelADD] += getTimeNs() - t0;
+			bytes[kCinKernelADD] += frameSize;
+			break;
+		}
+		memcpy(frameBuffers[1], frameBuffers[0], frameSize);
+		++framesCount;
+	}
+	printf("%s: %d frames\n", path, framesCount);
+	for (int i = 0; i < kCinKernelsCount; ++i) {
+		if (bytes[i] != 0) {
+			printResult(names[i], 0, bytes[i], ns[i]);
+		}
+	}
+	for (int i = 0; i < 3; ++i) {
+		free(frameBuffers[i]);
+	}
+	free(data);
+}
+
+int main(int argc, char *argv[]) {
+	const char *cinPath = 0;
+	const char *sndPath = 0;
+	for (int i = 1; i < argc; ++i) {
+		if (strncmp(argv[i], "--time=", 7) == 0) {
+			_minDurationMs = atoi(argv[i] + 7);
+		} else if (strncmp(argv[i], "--cin=", 6) == 0) {
+			cinPath = argv[i] + 6;
+		} else if (strncmp(argv[i], "--snd=", 6) == 0) {
+			sndPath = argv[i] + 6;
+		} else {
+			printf("%s\n", USAGE);
+			return -1;
+		}
+	}
+	Kernel *kernels[] = {
+		new KernelLZSS,
+		new KernelHuffman,
+		new KernelRLE,
+		new KernelADD,
+		new KernelDelta16,
+		new KernelScaler("point1x", point1x, 1),
+		new KernelScaler("point2x", point2x, 2),
+		new KernelScaler("point3x", point3x, 3),
+		new KernelScaler("scale2x", scale2x, 2),
+		new KernelScaler("scale3x", scale3x, 3),
+		new KernelFrustum(false),
+		new KernelFrustum(true),
+		new KernelParticles()
+	};
+	for (int i = 0; i < ARRAYSIZE(kernels); ++i) {
+		kernels[i]->bench();
+		delete kernels[i];
+	}
+	if (cinPath) {
+		benchCutscene(cinPath);
+	}
+	if (sndPath) {
+		int dataSize;
+		uint8_t *data = readFile(sndPath, &dataSize);
+		if (data) {
+			KernelDelta16 k(data, dataSize);
+			k.bench();
+			free(data);
+		}
+	}
+	return 0;
+}
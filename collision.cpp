@@ -6,7 +6,7 @@
 #include "game.h"
 
 CollisionSlot *Game::createCollisionSlot(CollisionSlot *prev, CollisionSlot *next, GameObject *o, CellMap *cell) {
-	CollisionSlot *colSlot = (CollisionSlot *)malloc(sizeof(CollisionSlot));
+	CollisionSlot *colSlot = (CollisionSlot *)memAlloc(kMemTag_COLLISION, sizeof(CollisionSlot));
 	if (colSlot) {
 		colSlot->o = o;
 		colSlot->prev = prev;
@@ -38,7 +38,7 @@ void Game::destroyCollisionSlot(CellMap *cell) {
 			colSlotPrev = colSlot->next;
 			colSlot->o = 0;
 			colSlot->next = colSlot->prev = 0;
-			free(colSlot);
+			memFree(colSlot);
 			colSlot = 0;
 		}
 		if (!colSlot) {
@@ -155,7 +155,7 @@ void Game::resetCollisionSlot(GameObject *o) {
 		colSlot->next = 0;
 		colSlot->prev = 0;
 		colSlot->list = 0;
-		free(colSlot);
+		memFree(colSlot);
 		colSlot = colSlotTmp;
 	}
 	o->colSlot = 0;
@@ -69,66 +69,6 @@ void Cutscene::updatePalette(int palType, int colorsCount, const uint8_t *p) {
 	_render->setPalette(_palette, 256);
 }
 
-static int decodeHuffman(const uint8_t *src, int srcSize, uint8_t *dst) {
-	const uint8_t *dstStart = dst;
-	const uint8_t *srcEnd = src + srcSize;
-	uint8_t data, code = 0;
-	int codeCount = 1;
-	uint8_t buf[15];
-	memcpy(buf, src, 15); src += 15;
-	while (src < srcEnd) {
-		if (codeCount == 1) {
-			code = *src++;
-			if ((code & 0xF0) == 0xF0) {
-				data = code << 4;
-				code = *src++;
-				data += code >> 4;
-			} else {
-				data = buf[code >> 4];
-			}
-			*dst++ = data;
-			--codeCount;
-		} else {
-			if ((code &= 0xF) == 0xF) {
-				*dst++ = *src++;
-				++codeCount;
-			} else {
-				code = buf[code];
-				*dst++ = code;
-				++codeCount;
-			}
-		}
-	}
-	if (codeCount != 1 && (code &= 0xF) != 0xF) {
-		*dst++ = buf[code];
-	}
-	return dst - dstStart;
-}
-
-static void decodeRLE(const uint8_t *src, int srcSize, uint8_t *dst) {
-	const uint8_t *srcEnd = src + srcSize;
-	while (src < srcEnd) {
-		int len;
-		uint8_t code = *src++;
-		if (code & 0x80) {
-			len = code - 0x7F;
-			memset(dst, *src++, len);
-		} else {
-			len = code + 1;
-			memcpy(dst, src, len);
-			src += len;
-		}
-		dst += len;
-	}
-	assert(src == srcEnd);
-}
-
-static void decodeADD(const uint8_t *src, int srcSize, uint8_t *dst) {
-	while (srcSize--) {
-		*dst++ += *src++;
-	}
-}
-
 void Cutscene::decodeImage(const uint8_t *frameData) {
 	int frameSize;
 	if (_frameHdr.videoFrameType != 1) {
@@ -397,9 +337,9 @@ bool Cutscene::load(int num) {
 		return false;
 	}
 	for (int i = 0; i < kFrameBuffersCount; ++i) {
-		_frameBuffers[i] = (uint8_t *)malloc(_fileHdr.videoFrameSize);
+		_frameBuffers[i] = (uint8_t *)memAlloc(kMemTag_CUTSCENE, _fileHdr.videoFrameSize);
 	}
-	_frameReadBuffer = (uint8_t *)malloc(_fileHdr.videoFrameSize + 1024);
+	_frameReadBuffer = (uint8_t *)memAlloc(kMemTag_CUTSCENE, _fileHdr.videoFrameSize + 1024);
 	_soundReadBuffer = 0;
 	_snd->_mix.playQueue(4);
 	_frameCounter = 0;
@@ -429,7 +369,7 @@ bool Cutscene::play() {
 		assert(palSize + _frameHdr.videoFrameSize < _fileHdr.videoFrameSize + 1024);
 		fileRead(_fp, _frameReadBuffer, palSize + _frameHdr.videoFrameSize);
 		if (!g_isDemo) {
-			_soundReadBuffer = (uint8_t *)realloc(_soundReadBuffer, _frameHdr.soundFrameSize);
+			_soundReadBuffer = (uint8_t *)memRealloc(kMemTag_CUTSCENE, _soundReadBuffer, _frameHdr.soundFrameSize);
 			if (_soundReadBuffer) {
 				fileRead(_fp, _soundReadBuffer, _frameHdr.soundFrameSize);
 				_snd->_mix.appendToQueue(_soundReadBuffer, _frameHdr.soundFrameSize);
@@ -448,12 +388,12 @@ bool Cutscene::play() {
 
 void Cutscene::unload() {
 	for (int i = 0; i < kFrameBuffersCount; ++i) {
-		free(_frameBuffers[i]);
+		memFree(_frameBuffers[i]);
 		_frameBuffers[i] = 0;
 	}
-	free(_frameReadBuffer);
+	memFree(_frameReadBuffer);
 	_frameReadBuffer = 0;
-	free(_soundReadBuffer);
+	memFree(_soundReadBuffer);
 	_soundReadBuffer = 0;
 	if (_fp) {
 		fileClose(_fp);
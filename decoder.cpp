@@ -26,3 +26,82 @@ void decodeLZSS(const uint8_t *src, uint8_t *dst, int decodedSize) {
 		}
 	}
 }
+
+int decodeHuffman(const uint8_t *src, int srcSize, uint8_t *dst) {
+	const uint8_t *dstStart = dst;
+	const uint8_t *srcEnd = src + srcSize;
+	uint8_t data, code = 0;
+	int codeCount = 1;
+	uint8_t buf[15];
+	memcpy(buf, src, 15); src += 15;
+	while (src < srcEnd) {
+		if (codeCount == 1) {
+			code = *src++;
+			if ((code & 0xF0) == 0xF0) {
+				data = code << 4;
+				code = *src++;
+				data += code >> 4;
+			} else {
+				data = buf[code >> 4];
+			}
+			*dst++ = data;
+			--codeCount;
+		} else {
+			if ((code &= 0xF) == 0xF) {
+				*dst++ = *src++;
+				++codeCount;
+			} else {
+				code = buf[code];
+				*dst++ = code;
+				++codeCount;
+			}
+		}
+	}
+	if (codeCount != 1 && (code &= 0xF) != 0xF) {
+		*dst++ = buf[code];
+	}
+	return dst - dstStart;
+}
+
+void decodeRLE(const uint8_t *src, int srcSize, uint8_t *dst) {
+	const uint8_t *srcEnd = src + srcSize;
+	while (src < srcEnd) {
+		int len;
+		uint8_t code = *src++;
+		if (code & 0x80) {
+			len = code - 0x7F;
+			memset(dst, *src++, len);
+		} else {
+			len = code + 1;
+			memcpy(dst, src, len);
+			src += len;
+		}
+		dst += len;
+	}
+	assert(src == srcEnd);
+}
+
+void decodeADD(const uint8_t *src, int srcSize, uint8_t *dst) {
+	while (srcSize--) {
+		*dst++ += *src++;
+	}
+}
+
+const int16_t g_delta16Table[128] = {
+	    0,      1,      2,      3,      4,      5,      6,      7,
+	    8,      9,     10,     11,     12,     13,     14,     15,
+	   17,     18,     20,     21,     23,     25,     27,     30,
+	   32,     35,     38,     41,     45,     49,     53,     58,
+	   62,     68,     74,     80,     87,     94,    102,    111,
+	  120,    130,    141,    153,    166,    181,    196,    212,
+	  230,    250,    271,    294,    319,    346,    376,    407,
+	  442,    479,    520,    564,    612,    663,    720,    781,
+	  847,    918,    996,   1080,   1172,   1271,   1379,   1495,
+	 1622,   1759,   1908,   2070,   2245,   2435,   2641,   2865,
+	 3107,   3370,   3655,   3964,   4300,   4664,   5059,   5487,
+	 5951,   6455,   7001,   7593,   8236,   8933,   9689,  10508,
+	11398,  12362,  13408,  14543,  15774,  17108,  18556,  20126,
+	21829,  23677,  25680,  27853,  30210,      0,      0,      0,
+            0,      0,      0,      0,      0,      0,      0,      0,
+            0,      0,      0,      0,      0,      0,      0,      0
+};
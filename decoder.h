@@ -9,5 +9,40 @@
 #include "util.h"
 
 void decodeLZSS(const uint8_t *src, uint8_t *dst, int decodedSize);
+int decodeHuffman(const uint8_t *src, int srcSize, uint8_t *dst);
+void decodeRLE(const uint8_t *src, int srcSize, uint8_t *dst);
+void decodeADD(const uint8_t *src, int srcSize, uint8_t *dst);
+
+extern const int16_t g_delta16Table[128];
+
+struct Delta16Decoder {
+	int _firstSample;
+	int _delta;
+
+	Delta16Decoder()
+		: _firstSample(0), _delta(0) {
+	}
+
+	int decode(uint8_t data) {
+		switch (_firstSample) {
+		case 0:
+			_delta = data;
+			_firstSample = 1;
+			break;
+		case 1:
+			_delta = (int16_t)((data << 8) | _delta);
+			_firstSample = 2;
+			break;
+		default:
+			if (data & (1 << 7)) {
+				_delta += g_delta16Table[data - 128];
+			} else {
+				_delta -= g_delta16Table[127 - data];
+			}
+			break;
+		}
+		return _firstSample == 1 ? 0 : CLIP(_delta, -32768, 32767);
+	}
+};
 
 #endif // DECODER_H__
@@ -181,7 +181,7 @@ static void fileMakeFilePath(const char *fileName, int fileType, int fileLang, c
 
 static File *fileOpenIntern(const char *fileName, int fileType) {
 	char filePath[MAXPATHLEN];
-	if (fileType == kFileType_SAVE || fileType == kFileType_LOAD || fileType == kFileType_SCREENSHOT) {
+	if (fileType == kFileType_SAVE || fileType == kFileType_LOAD || fileType == kFileType_SCREENSHOT || fileType == kFileType_DUMP) {
 		snprintf(filePath, sizeof(filePath), "%s/%s", _fileSavePath, fileName);
 		File *fp = 0;
 		switch (fileType) {
@@ -190,6 +190,7 @@ static File *fileOpenIntern(const char *fileName, int fileType) {
 			fp = new GzipFile;
 			break;
 		case kFileType_SCREENSHOT:
+		case kFileType_DUMP:
 			fp = new StdioFile;
 			break;
 		default:
@@ -17,6 +17,7 @@ enum FileType {
 	kFileType_LOAD,
 	kFileType_SAVE,
 	kFileType_SCREENSHOT,
+	kFileType_DUMP,
 };
 
 enum FileLanguage {
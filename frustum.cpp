@@ -0,0 +1,237 @@
+/*
+ * Fade To Black engine rewrite
+ * Copyright (C) 2006-2012 Gregory Montoir (cyx@users.sourceforge.net)
+ */
+
+#include "frustum.h"
+#include "simd.h"
+
+//
+// The batched tests classify 4 boxes or points per iteration with SSE2 or
+// NEON, each plane coefficient is broadcast to the 4 lanes. The single
+// point test handles 4 planes per iteration instead, hence the padding of
+// the planes arrays to 8. The operations are done in the same order as the
+// scalar code, both return the same results.
+//
+
+void Frustum_setPlanes(FrustumPlanes *planes, const Vertex4f *v) {
+	for (int i = 0; i < 8; ++i) {
+		if (i < kFrustrumPlanesCount) {
+			planes->a[i] = v[i].x;
+			planes->b[i] = v[i].y;
+			planes->c[i] = v[i].z;
+			planes->d[i] = v[i].w;
+		} else {
+			planes->a[i] = planes->b[i] = planes->c[i] = 0;
+			planes->d[i] = 1;
+		}
+	}
+}
+
+static int testBox(const FrustumPlanes *planes, const FrustumBoxes *boxes, int i) {
+	int ret = kFrustrumInside;
+	for (int j = 0; j < kFrustrumPlanesCount; ++j) {
+		// corners the farthest along and against the plane normal
+		const float px = (planes->a[j] > 0) ? boxes->maxX[i] : boxes->minX[i];
+		const float py = (planes->b[j] > 0) ? boxes->maxY[i] : boxes->minY[i];
+		const float pz = (planes->c[j] > 0) ? boxes->maxZ[i] : boxes->minZ[i];
+		if (planes->a[j] * px + planes->b[j] * py + planes->c[j] * pz + planes->d[j] <= 0) {
+			return kFrustrumOutside;
+		}
+		const float nx = (planes->a[j] > 0) ? boxes->minX[i] : boxes->maxX[i];
+		const float ny = (planes->b[j] > 0) ? boxes->minY[i] : boxes->maxY[i];
+		const float nz = (planes->c[j] > 0) ? boxes->minZ[i] : boxes->maxZ[i];
+		if (planes->a[j] * nx + planes->b[j] * ny + planes->c[j] * nz + planes->d[j] <= 0) {
+			ret = kFrustrumIntersect;
+		}
+	}
+	return ret;
+}
+
+static bool testPoint(const FrustumPlanes *planes, float x, float y, float z) {
+	for (int j = 0; j < kFrustrumPlanesCount; ++j) {
+		if (planes->a[j] * x + planes->b[j] * y + planes->c[j] * z + planes->d[j] <= 0) {
+			return false;
+		}
+	}
+	return true;
+}
+
+#if defined(F2B_SSE2) || defined(F2B_NEON)
+static void setBoxResults(int outsideMask, int intersectMask, uint8_t *results) {
+	for (int k = 0; k < 4; ++k) {
+		if (outsideMask & (1 << k)) {
+			results[k] = kFrustrumOutside;
+		} else if (intersectMask & (1 << k)) {
+			results[k] = kFrustrumIntersect;
+		} else {
+			results[k] = kFrustrumInside;
+		}
+	}
+}
+#endif
+
+#if defined(F2B_SSE2)
+
+static inline __m128 planeDistance(__m128 a, __m128 b, __m128 c, __m128 d, __m128 x, __m128 y, __m128 z) {
+	return _mm_add_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(a, x), _mm_mul_ps(b, y)), _mm_mul_ps(c, z)), d);
+}
+
+static void testBoxes4(const FrustumPlanes *planes, const FrustumBoxes *boxes, int i, uint8_t *results) {
+	const __m128 zero = _mm_setzero_ps();
+	__m128 outside = zero;
+	__m128 intersect = zero;
+	for (int j = 0; j < kFrustrumPlanesCount; ++j) {
+		const __m128 a = _mm_set1_ps(planes->a[j]);
+		const __m128 b = _mm_set1_ps(planes->b[j]);
+		const __m128 c = _mm_set1_ps(planes->c[j]);
+		const __m128 d = _mm_set1_ps(planes->d[j]);
+		const bool ax = planes->a[j] > 0;
+		const bool by = planes->b[j] > 0;
+		const bool cz = planes->c[j] > 0;
+		const __m128 px = _mm_loadu_ps((ax ? boxes->maxX : boxes->minX) + i);
+		const __m128 py = _mm_loadu_ps((by ? boxes->maxY : boxes->minY) + i);
+		const __m128 pz = _mm_loadu_ps((cz ? boxes->maxZ : boxes->minZ) + i);
+		outside = _mm_or_ps(outside, _mm_cmple_ps(planeDistance(a, b, c, d, px, py, pz), zero));
+		if (_mm_movemask_ps(outside) == 15) {
+			break;
+		}
+		const __m128 nx = _mm_loadu_ps((ax ? boxes->minX : boxes->maxX) + i);
+		const __m128 ny = _mm_loadu_ps((by ? boxes->minY : boxes->maxY) + i);
+		const __m128 nz = _mm_loadu_ps((cz ? boxes->minZ : boxes->maxZ) + i);
+		intersect = _mm_or_ps(intersect, _mm_cmple_ps(planeDistance(a, b, c, d, nx, ny, nz), zero));
+	}
+	setBoxResults(_mm_movemask_ps(outside), _mm_movemask_ps(intersect), results + i);
+}
+
+static void testPoints4(const FrustumPlanes *planes, const float *x, const float *y, const float *z, uint8_t *inside) {
+	const __m128 zero = _mm_setzero_ps();
+	const __m128 px = _mm_loadu_ps(x);
+	const __m128 py = _mm_loadu_ps(y);
+	const __m128 pz = _mm_loadu_ps(z);
+	__m128 outside = zero;
+	for (int j = 0; j < kFrustrumPlanesCount; ++j) {
+		const __m128 dist = planeDistance(_mm_set1_ps(planes->a[j]), _mm_set1_ps(planes->b[j]), _mm_set1_ps(planes->c[j]), _mm_set1_ps(planes->d[j]), px, py, pz);
+		outside = _mm_or_ps(outside, _mm_cmple_ps(dist, zero));
+	}
+	const int mask = _mm_movemask_ps(outside);
+	for (int k = 0; k < 4; ++k) {
+		inside[k] = (mask & (1 << k)) == 0;
+	}
+}
+
+bool Frustum_isPointInside(const FrustumPlanes *planes, float x, float y, float z) {
+	const __m128 zero = _mm_setzero_ps();
+	const __m128 px = _mm_set1_ps(x);
+	const __m128 py = _mm_set1_ps(y);
+	const __m128 pz = _mm_set1_ps(z);
+	const __m128 dist0 = planeDistance(_mm_loadu_ps(planes->a), _mm_loadu_ps(planes->b), _mm_loadu_ps(planes->c), _mm_loadu_ps(planes->d), px, py, pz);
+	const __m128 dist1 = planeDistance(_mm_loadu_ps(planes->a + 4), _mm_loadu_ps(planes->b + 4), _mm_loadu_ps(planes->c + 4), _mm_loadu_ps(planes->d + 4), px, py, pz);
+	return _mm_movemask_ps(_mm_or_ps(_mm_cmple_ps(dist0, zero), _mm_cmple_ps(dist1, zero))) == 0;
+}
+
+#elif defined(F2B_NEON)
+
+static inline float32x4_t planeDistance(float32x4_t a, float32x4_t b, float32x4_t c, float32x4_t d, float32x4_t x, float32x4_t y, float32x4_t z) {
+	return vaddq_f32(vaddq_f32(vaddq_f32(vmulq_f32(a, x), vmulq_f32(b, y)), vmulq_f32(c, z)), d);
+}
+
+static int getMask(uint32x4_t v) {
+	uint32_t lanes[4];
+	vst1q_u32(lanes, v);
+	return (lanes[0] & 1) | (lanes[1] & 2) | (lanes[2] & 4) | (lanes[3] & 8);
+}
+
+static void testBoxes4(const FrustumPlanes *planes, const FrustumBoxes *boxes, int i, uint8_t *results) {
+	const float32x4_t zero = vdupq_n_f32(0);
+	uint32x4_t outside = vdupq_n_u32(0);
+	uint32x4_t intersect = vdupq_n_u32(0);
+	for (int j = 0; j < kFrustrumPlanesCount; ++j) {
+		const float32x4_t a = vdupq_n_f32(planes->a[j]);
+		const float32x4_t b = vdupq_n_f32(planes->b[j]);
+		const float32x4_t c = vdupq_n_f32(planes->c[j]);
+		const float32x4_t d = vdupq_n_f32(planes->d[j]);
+		const bool ax = planes->a[j] > 0;
+		const bool by = planes->b[j] > 0;
+		const bool cz = planes->c[j] > 0;
+		const float32x4_t px = vld1q_f32((ax ? boxes->maxX : boxes->minX) + i);
+		const float32x4_t py = vld1q_f32((by ? boxes->maxY : boxes->minY) + i);
+		const float32x4_t pz = vld1q_f32((cz ? boxes->maxZ : boxes->minZ) + i);
+		outside = vorrq_u32(outside, vcleq_f32(planeDistance(a, b, c, d, px, py, pz), zero));
+		if (getMask(outside) == 15) {
+			break;
+		}
+		const float32x4_t nx = vld1q_f32((ax ? boxes->minX : boxes->maxX) + i);
+		const float32x4_t ny = vld1q_f32((by ? boxes->minY : boxes->maxY) + i);
+		const float32x4_t nz = vld1q_f32((cz ? boxes->minZ : boxes->maxZ) + i);
+		intersect = vorrq_u32(intersect, vcleq_f32(planeDistance(a, b, c, d, nx, ny, nz), zero));
+	}
+	setBoxResults(getMask(outside), getMask(intersect), results + i);
+}
+
+static void testPoints4(const FrustumPlanes *planes, const float *x, const float *y, const float *z, uint8_t *inside) {
+	const float32x4_t zero = vdupq_n_f32(0);
+	const float32x4_t px = vld1q_f32(x);
+	const float32x4_t py = vld1q_f32(y);
+	const float32x4_t pz = vld1q_f32(z);
+	uint32x4_t outside = vdupq_n_u32(0);
+	for (int j = 0; j < kFrustrumPlanesCount; ++j) {
+		const float32x4_t dist = planeDistance(vdupq_n_f32(planes->a[j]), vdupq_n_f32(planes->b[j]), vdupq_n_f32(planes->c[j]), vdupq_n_f32(planes->d[j]), px, py, pz);
+		outside = vorrq_u32(outside, vcleq_f32(dist, zero));
+	}
+	const int mask = getMask(outside);
+	for (int k = 0; k < 4; ++k) {
+		inside[k] = (mask & (1 << k)) == 0;
+	}
+}
+
+bool Frustum_isPointInside(const FrustumPlanes *planes, float x, float y, float z) {
+	const float32x4_t zero = vdupq_n_f32(0);
+	const float32x4_t px = vdupq_n_f32(x);
+	const float32x4_t py = vdupq_n_f32(y);
+	const float32x4_t pz = vdupq_n_f32(z);
+	const float32x4_t dist0 = planeDistance(vld1q_f32(planes->a), vld1q_f32(planes->b), vld1q_f32(planes->c), vld1q_f32(planes->d), px, py, pz);
+	const float32x4_t dist1 = planeDistance(vld1q_f32(planes->a + 4), vld1q_f32(planes->b + 4), vld1q_f32(planes->c + 4), vld1q_f32(planes->d + 4), px, py, pz);
+	return getMask(vorrq_u32(vcleq_f32(dist0, zero), vcleq_f32(dist1, zero))) == 0;
+}
+
+#else
+
+static void testBoxes4(const FrustumPlanes *planes, const FrustumBoxes *boxes, int i, uint8_t *results) {
+	for (int k = 0; k < 4; ++k) {
+		results[i + k] = testBox(planes, boxes, i + k);
+	}
+}
+
+static void testPoints4(const FrustumPlanes *planes, const float *x, const float *y, const float *z, uint8_t *inside) {
+	for (int k = 0; k < 4; ++k) {
+		inside[k] = testPoint(planes, x[k], y[k], z[k]);
+	}
+}
+
+bool Frustum_isPointInside(const FrustumPlanes *planes, float x, float y, float z) {
+	return testPoint(planes, x, y, z);
+}
+
+#endif
+
+void Frustum_testBoxes(const FrustumPlanes *planes, const FrustumBoxes *boxes, uint8_t *results) {
+	assert(boxes->count <= kFrustrumBatchSize);
+	int i = 0;
+	for (; i + 4 <= boxes->count; i += 4) {
+		testBoxes4(planes, boxes, i, results);
+	}
+	for (; i < boxes->count; ++i) {
+		results[i] = testBox(planes, boxes, i);
+	}
+}
+
+void Frustum_testPoints(const FrustumPlanes *planes, const float *x, const float *y, const float *z, int count, uint8_t *inside) {
+	int i = 0;
+	for (; i + 4 <= count; i += 4) {
+		testPoints4(planes, x + i, y + i, z + i, inside + i);
+	}
+	for (; i < count; ++i) {
+		inside[i] = testPoint(planes, x[i], y[i], z[i]);
+	}
+}
@@ -0,0 +1,42 @@
+/*
+ * Fade To Black engine rewrite
+ * Copyright (C) 2006-2012 Gregory Montoir (cyx@users.sourceforge.net)
+ */
+
+#ifndef FRUSTUM_H__
+#define FRUSTUM_H__
+
+#include "matrix.h"
+
+enum {
+	kFrustrumOutside = 0,
+	kFrustrumIntersect,
+	kFrustrumInside
+};
+
+static const int kFrustrumPlanesCount = 6;
+static const int kFrustrumBatchSize = 64; // boxes per Frustum_testBoxes call
+
+// the planes as structure of arrays, padded with planes all the vertices
+// are in front of. A vertex is in the frustum if a*x + b*y + c*z + d > 0
+// for all the planes.
+struct FrustumPlanes {
+	float a[8], b[8], c[8], d[8];
+};
+
+// axis aligned boxes as structure of arrays
+struct FrustumBoxes {
+	int count;
+	float minX[kFrustrumBatchSize], minY[kFrustrumBatchSize], minZ[kFrustrumBatchSize];
+	float maxX[kFrustrumBatchSize], maxY[kFrustrumBatchSize], maxZ[kFrustrumBatchSize];
+};
+
+void Frustum_setPlanes(FrustumPlanes *planes, const Vertex4f *v);
+bool Frustum_isPointInside(const FrustumPlanes *planes, float x, float y, float z);
+
+// results[i] is set to kFrustrumOutside, kFrustrumIntersect or kFrustrumInside
+void Frustum_testBoxes(const FrustumPlanes *planes, const FrustumBoxes *boxes, uint8_t *results);
+// inside[i] is set to 1 if the point is in the frustum
+void Frustum_testPoints(const FrustumPlanes *planes, const float *x, const float *y, const float *z, int count, uint8_t *inside);
+
+#endif // FRUSTUM_H__
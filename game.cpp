@@ -6,10 +6,117 @@
 #include "decoder.h"
 #include "file.h"
 #include "game.h"
+#include "profiler.h"
 #include "trigo.h"
 #include "resource.h"
 #include "render.h"
 
+#ifdef F2B_PROFILE
+// same order as _opcodeTable
+static const char *_opcodeNames[kOpcodesCount] = {
+	// 0
+	"true",
+	"toggleInput",
+	"compareCamera",
+	"sendMessage",
+	// 4
+	"getObjectMessage",
+	"setParticleParams",
+	"setVar",
+	"compareConst",
+	// 8
+	"evalVar",
+	"playSound",
+	"isCurrentObjectInDrawList",
+	"getAngle",
+	// 12
+	"setObjectData",
+	"evalObjectData",
+	"compareObjectData",
+	"enterMenuSaveGame",
+	// 16
+	"enterMenuLoadGame",
+	"jumpToNextLevel",
+	"quitGame",
+	"rand",
+	// 20
+	"isObjectColliding",
+	"sendShootMessage",
+	"getShootInfo",
+	"updateTarget",
+	// 24
+	"moveObjectToObject",
+	"getObject9",
+	"setObjectParent",
+	"removeObjectMessage",
+	// 28
+	"setBoxItem",
+	"fadePalette",
+	"isObjectMoving",
+	"getMessageInfo",
+	// 32
+	"testObjectsRoom",
+	"setCellMapData",
+	"addCellMapData",
+	"compareCellMapData",
+	// 36
+	"getObjectDistance",
+	"setObjectSpecialCustomData",
+	"transformObjectPos",
+	"compareObjectAngle",
+	// 40
+	"moveObjectToPos",
+	"setupObjectPath",
+	"continueObjectMove",
+	"compareInput",
+	// 44
+	"clearTarget",
+	"playCutscene",
+	"setScriptCond",
+	"isObjectMessageNull",
+	// 48
+	"detachObjectChild",
+	"setCamera",
+	"getSquareDistance",
+	"isObjectTarget",
+	// 52
+	"printDebug",
+	"translateObject",
+	"setupTarget",
+	"getTicks",
+	// 56
+	"swapFrameXZ",
+	"addObjectMessage",
+	"setupCircularMove",
+	"moveObjectOnCircle",
+	// 60
+	"isObjectCollidingType",
+	"setLevelData",
+	"drawNumber",
+	"isObjectOnMap",
+	// 64
+	"isCollidingLine",
+	"updateFollowingObject",
+	"rotateCoords",
+	"translateObject2",
+	// 68
+	"updateCollidingHorizontalMask",
+	"createParticle",
+	"setupFollowingObject",
+	"isObjectCollidingPos",
+	// 72
+	"setCameraObject",
+	"setCameraParams",
+	"setPlayerObject",
+	"isCollidingRooms",
+	// 76
+	"isMessageOnScreen",
+	"debugBreakpoint",
+	"isObjectConradNotVisible",
+	"stopSound"
+};
+#endif
+
 Game::Game(Render *render, const GameParams *params)
 	: _cut(render, this, &_snd), _snd(&_res), _render(render), _params(*params) {
 
@@ -19,6 +126,9 @@ Game::Game(Render *render, const GameParams *params)
 
 	_ticks = 0;
 	_level = 0;
+	_demoRecordFp = 0;
+	_stateHashFp = 0;
+	memset(&_perfHud, 0, sizeof(_perfHud));
 	_skillLevel = kSkillNormal;
 	_changeLevel = false;
 	_room = _roomPrev = -1;
@@ -36,10 +146,25 @@ Game::Game(Render *render, const GameParams *params)
 	memset(_sceneTextureImagesBuffer, 0, sizeof(_sceneTextureImagesBuffer));
 	memset(_sceneObjectsTable, 0, sizeof(_sceneObjectsTable));
 	memset(_sceneCellMap, 0, sizeof(_sceneCellMap));
+	_sceneStaticQuadsTable = 0;
+	_sceneStaticQuadsMask = 0;
+	_sceneStaticQuadsCount = 0;
+	memset(_scenePvsTable, 0, sizeof(_scenePvsTable));
 	memset(_playerMessagesTable, 0, sizeof(_playerMessagesTable));
 }
 
 Game::~Game() {
+	if (_demoRecordFp) {
+		fileClose(_demoRecordFp);
+	}
+	if (_stateHashFp) {
+		fileClose(_stateHashFp);
+	}
+	memFree(_sceneStaticQuadsTable);
+	memFree(_sceneStaticQuadsMask);
+	for (int i = 0; i < ARRAYSIZE(_scenePvsTable); ++i) {
+		memFree(_scenePvsTable[i].cells);
+	}
 }
 
 void Game::clearGlobalData() {
@@ -124,8 +249,14 @@ void Game::clearLevelData() {
 	_rnd.reset();
 
 	_spriteCache.flush();
+	_meshCache.flush();
 	_infoPanelSpr.data = 0;
 	_render->flushCachedTextures();
+	memFree(_sceneStaticQuadsTable);
+	_sceneStaticQuadsTable = 0;
+	memFree(_sceneStaticQuadsMask);
+	_sceneStaticQuadsMask = 0;
+	_sceneStaticQuadsCount = 0;
 
 	for (int i = 0; i < ARRAYSIZE(_objectKeysTable); ++i) {
 		GameObject *o = _objectKeysTable[i];
@@ -133,7 +264,7 @@ void Game::clearLevelData() {
 			GameMessage *msg = o->msg;
 			while (msg) {
 				GameMessage *next = msg->next;
-				free(msg);
+				memFree(msg);
 				msg = next;
 			}
 			o->msg = 0;
@@ -853,6 +984,8 @@ void Game::loadSceneMap(int16_t key) {
 		}
 		q += 52;
 	}
+	initStaticSceneQuads();
+	initScenePvs();
 }
 
 bool Game::updateSceneAnimationsKeyFrame(int rnd, int index, SceneAnimation *sa, SceneAnimationState *sas) {
@@ -1092,6 +1225,9 @@ void Game::initScene() {
 void Game::init() {
 	debug(kDebug_GAME, "Game::init()");
 
+#ifdef F2B_PROFILE
+	Profiler_setOpcodeNames(_opcodeNames, kOpcodesCount);
+#endif
 	_res.loadTrigo();
 
 	int dataSize;
@@ -1101,6 +1237,10 @@ void Game::init() {
 
 	_snd.init();
 
+	if (_params.stateHash != kStateHashNone) {
+		initStateHash();
+	}
+
 	_ticks = 0;
 	_level = _params.levelNum;
 	initLevel();
@@ -1108,6 +1248,13 @@ void Game::init() {
 
 void Game::initLevel() {
 	debug(kDebug_GAME, "Game::initLevel() %d\n", _level);
+#ifdef F2B_PROFILE
+	Profiler_printScriptsReport();
+	Profiler_setScriptsLevel(_level);
+#endif
+	char title[32];
+	snprintf(title, sizeof(title), "before level %d", _level);
+	memPrintStats(title, true);
 
 	int32_t flag = -1;
 	op_clearTarget(1, &flag);
@@ -1124,9 +1271,17 @@ void Game::initLevel() {
 		if (fp) {
 			_res.loadDEM(fp, dataSize);
 			fileClose(fp);
+			if (_res._demoRandSeed >= 0) {
+				_rnd._randSeed = _res._demoRandSeed;
+			}
 		}
 	}
 	_demoInput = 0;
+	// the original .DEM files use the ticks since the start of the game
+	_demoTicksBase = _res._demoHeader ? _ticks : 0;
+	if (_params.recordDemo) {
+		initDemoRecord();
+	}
 
 	_snd._musicMode = 1;
 	_snd._musicKey = 0;
@@ -1140,7 +1295,7 @@ void Game::initLevel() {
 	memset(_screenPalette, 0, sizeof(_screenPalette));
 	memset(_indirectPalette, 0, sizeof(_indirectPalette));
 	memset(_mrkBuffer, 0, sizeof(_mrkBuffer));
-	_particlesCount = 0;
+	_particles.count = 0;
 
 	_mainLoopCurrentMode = 0;
 	_conradHit = 0;
@@ -1316,7 +1471,7 @@ void Game::clearObjectMessage(GameObject *o) {
 	GameMessage *m_cur = o->msg;
 	while (m_cur) {
 		GameMessage *m_next = m_cur->next;
-		free(m_cur);
+		memFree(m_cur);
 		m_cur = m_next;
 	}
 	o->msg = 0;
@@ -1639,6 +1794,7 @@ static const Game::OpcodeProc _opcodeTable[kOpcodesCount] = {
 int Game::executeObjectScriptOpcode(GameObject *o, uint32_t op, const uint8_t *data) {
 	int32_t val, argv[8];
 
+	PROFILE_COUNTER(kProfCounter_opcode, op, 0);
 	debug(kDebug_GAME, "Game::executeObjectScriptOpcode() o %p op %d", o, op);
 	assert(op < kOpcodesCount);
 	const int argc = g_isDemo ? _opcodeSize_demo[op] : _opcodeSize[op];
@@ -1684,6 +1840,7 @@ uint8_t *Game::getNextScriptAnim() {
 }
 
 int Game::executeObjectScript(GameObject *o) {
+	PROFILE_COUNTER(kProfCounter_object, 0, o->name);
 	int runScript = 0;
 	int currentInput = getCurrentInput();
 	uint8_t inputKey0 = _inputsTable[currentInput].inputKey0;
@@ -1757,6 +1914,7 @@ int Game::executeObjectScript(GameObject *o) {
 		while (_currentObject->scriptCondData && !stopScript) {
 			const int scriptCmdNum = READ_LE_UINT16(_currentObject->scriptCondData);
 			debug(kDebug_OPCODES, "scriptCmdNum=%d object='%s' key=%d", scriptCmdNum, _currentObject->name, _currentObject->objKey);
+			PROFILE_COUNTER(kProfCounter_script, scriptCmdNum, 0);
 			const uint8_t *scriptData = _res.getCmdData(scriptCmdNum);
 			int scriptRet = 1;
 			while (scriptRet) {
@@ -2472,9 +2630,18 @@ void Game::updateObjects() {
 }
 
 void Game::doTick() {
+	PROFILE_TICK(_ticks);
+	PROFILE_SCOPE(kProfPhase_doTick);
+	const uint64_t tickStartNs = _perfHud.enabled ? getTimeNs() : 0;
 	const int currentRoom = _room;
-	updateSceneAnimations();
-	updateSceneTextures();
+	{
+		PROFILE_SCOPE(kProfPhase_updateSceneAnimations);
+		updateSceneAnimations();
+	}
+	{
+		PROFILE_SCOPE(kProfPhase_updateSceneTextures);
+		updateSceneTextures();
+	}
 	if (_mainLoopCurrentMode == 0) {
 		if (_viewportSize > 0) {
 			_viewportSize -= 2;
@@ -2495,18 +2662,36 @@ void Game::doTick() {
 			break;
 		}
 	}
-	updatePlayerObject();
-	redrawScene();
+	{
+		PROFILE_SCOPE(kProfPhase_updatePlayerObject);
+		updatePlayerObject();
+	}
+	{
+		PROFILE_SCOPE(kProfPhase_redrawScene);
+		redrawScene();
+	}
 	if (_changedObjectsCount != 0) {
+		PROFILE_SCOPE(kProfPhase_updateChangedObjects);
 		updateChangedObjects();
 	}
-	addObjectsToScene();
+	{
+		PROFILE_SCOPE(kProfPhase_addObjectsToScene);
+		addObjectsToScene();
+	}
 	updateObjects();
+	if (_render->_batchObjects) {
+		// the objects and particles are sorted with the ground and walls
+		PROFILE_SCOPE(kProfPhase_flushTexJobList);
+		_render->flushTexJobList();
+	}
 	++_ticks;
 	if ((_cheats & kCheatLifeCounter) != 0) {
 		_objectsPtrTable[kObjPtrConrad]->specialData[1][18] = _varsTable[kVarConradLife];
 	}
-	runObject(_objectsPtrTable[kObjPtrWorld]->o_child);
+	{
+		PROFILE_SCOPE(kProfPhase_runObject);
+		runObject(_objectsPtrTable[kObjPtrWorld]->o_child);
+	}
 if (_mainLoopCurrentMode == 1) {
 	GameObject *o_ply = getObjectByKey(_varsTable[kVarPlayerObject]);
 	CellMap *cell = getCellMapShr19(o_ply->xPosParent + o_ply->xPos, o_ply->zPosParent + o_ply->zPos);
@@ -2603,7 +2788,10 @@ if (_mainLoopCurrentMode == 1) {
 		}
 	}
 	_render->setupProjection2d();
-	drawInfoPanel();
+	{
+		PROFILE_SCOPE(kProfPhase_drawInfoPanel);
+		drawInfoPanel();
+	}
 #ifdef F2B_DEBUG
 	if (1) {
 		int y = 8;
@@ -2617,6 +2805,9 @@ if (_mainLoopCurrentMode == 1) {
 		y += 8;
 	}
 #endif
+	if (_perfHud.enabled) {
+		drawPerfHud();
+	}
 	if (_cut._numToPlayCounter >= 0) {
 		if (_cut._numToPlayCounter == 0) {
 			if (_cut._numToPlay >= 0) {
@@ -2645,8 +2836,42 @@ if (_mainLoopCurrentMode == 1) {
 	updateScreen();
 }
 	if (_collidingObjectsCount != 0) {
+		PROFILE_SCOPE(kProfPhase_updateCollidingObjects);
 		updateCollidingObjects();
 	}
+	if (_stateHashFp) {
+		updateStateHash();
+	}
+	if (_perfHud.enabled) {
+		_perfHud.tickUs = (int)((getTimeNs() - tickStartNs) / 1000);
+	}
+}
+
+void Game::drawPerfHud() {
+	const uint64_t nowNs = getTimeNs();
+	++_perfHud.framesCount;
+	if (_perfHud.fpsStartNs == 0) {
+		_perfHud.fpsStartNs = nowNs;
+	} else if (nowNs - _perfHud.fpsStartNs >= 1000000000) {
+		_perfHud.fps = (int)(_perfHud.framesCount * 1000000000LL / (nowNs - _perfHud.fpsStartNs));
+		_perfHud.fpsStartNs = nowNs;
+		_perfHud.framesCount = 0;
+	}
+	const RenderStats &rs = _render->_frameStats;
+	char buf[6][64];
+	snprintf(buf[0], sizeof(buf[0]), "fps %d tick %d.%02d ms", _perfHud.fps, _perfHud.tickUs / 1000, (_perfHud.tickUs % 1000) / 10);
+	snprintf(buf[1], sizeof(buf[1]), "draws %d tris %d uploads %d", rs.drawCallsCount, rs.trianglesCount, rs.texUploadsCount);
+	snprintf(buf[2], sizeof(buf[2]), "atlas %d%% of %d evicted %d", rs.atlasUsage, rs.atlasesCount, rs.texEvictionsCount);
+	snprintf(buf[3], sizeof(buf[3]), "sprites hit %d miss %d", _spriteCache._hitsCount, _spriteCache._missesCount);
+	snprintf(buf[4], sizeof(buf[4]), "meshes hit %d miss %d", _meshCache._hitsCount, _meshCache._missesCount);
+	snprintf(buf[5], sizeof(buf[5]), "voices %d", _snd._mix.getActiveVoicesCount());
+	_spriteCache._hitsCount = _spriteCache._missesCount = 0;
+	_meshCache._hitsCount = _meshCache._missesCount = 0;
+	int y = 32;
+	for (int i = 0; i < ARRAYSIZE(buf); ++i) {
+		drawString(8, y, buf[i], kFontNormale, 0);
+		y += 8;
+	}
 }
 
 void Game::initSprite(int type, int16_t key, SpriteImage *spr) {
@@ -2874,90 +3099,31 @@ bool Game::getMessage(int16_t key, uint32_t value, ResMessageDescription *desc)
 }
 
 void Game::drawSceneObjectMesh(const uint8_t *polygonsData, const uint8_t *verticesData, int verticesCount) {
-	if (polygonsData[0] & 0x80) {
-		const int shadowPolySize = -(int8_t)polygonsData[0];
+//	if (polygonsData[0] & 0x80) {
 //		drawSceneObjectMeshShadow(&polygonsData[1], verticesData, verticesCount);
-		polygonsData += shadowPolySize;
-	}
-	int count = *polygonsData++;
-	int color = READ_LE_UINT16(polygonsData); polygonsData += 2;
-	while (count != 0) {
-		Vertex polygonPoints[16];
-		if (count & 0x40) {
-			count &= 15;
-			for (int i = 0; i <= count; ++i) {
-				int index = *polygonsData++;
-				if (index >= verticesCount) {
-					warning("Game::drawSceneObjectMesh() invalid index %d in vertex buffer (size %d)", index, verticesCount);
-					return;
-				}
-				assert(index < verticesCount);
-				polygonPoints[i] = READ_VERTEX32(verticesData + index * 4);
-			}
-		} else {
-			count &= 15;
-			for (int i = 0; i <= count; ++i) {
-				int index = READ_LE_UINT16(polygonsData); polygonsData += 2;
-				assert(index < verticesCount);
-				polygonPoints[i] = READ_VERTEX32(verticesData + index * 4);
-			}
-		}
-		const int fill = (color >> 8) & 31;
-		if (fill == 8 || fill == 11 || fill == 12) {
-			const int texture = color & 255;
-			const int primitive = (color >> 13) & 7;
+//	}
+	const Mesh *mesh = _meshCache.getMesh(polygonsData, verticesData, verticesCount);
+	if (!mesh) {
+		return;
+	}
+	for (int i = 0; i < mesh->polygonsCount; ++i) {
+		const MeshPolygon *p = &mesh->polygons[i];
+		const Vertex *polygonPoints = &mesh->vertices[p->verticesOffset];
+		if (p->type == kMeshPolygonTexture) {
+			const int texture = p->color;
 			if (!_sceneTextureImagesBuffer[texture].data) { // level3
 				warning("Game::drawSceneObjectMesh() no sprite for texture %d", texture);
 			} else {
 				SpriteImage *spr = &_sceneTextureImagesBuffer[texture];
 				const uint8_t *texData = _spriteCache.getData(spr->key, spr->data);
-				_render->drawPolygonTexture(polygonPoints, count + 1, primitive, texData, spr->w, spr->h, spr->key);
+				_render->drawPolygonTexture(polygonPoints, p->verticesCount, p->primitive, texData, spr->w, spr->h, spr->key);
 			}
 			// 11 : transparent, pixel != 0 pixel + scolor
 			//  8 : palette remap, pixel + scolor
 			// 12 : pixel + 0
-		} else if (fill != 10) {
-			const int primitive = color >> 8;
-			switch (primitive) {
-			case 0:
-			case 1:
-				color &= 255;
-				break;
-			case 2:
-				color = kFlatColorShadow;
-				break;
-			case 3:
-				color = kFlatColorLight;
-				break;
-			case 4:
-				color = kFlatColorGreen;
-				break;
-			case 5:
-				color = kFlatColorRed;
-				break;
-			case 6:
-				color = kFlatColorYellow;
-				break;
-			case 7:
-				color = kFlatColorBlue;
-				break;
-			case 8:
-				color = kFlatColorShadow;
-				break;
-			case 9:
-				color = kFlatColorLight9;
-				break;
-			default:
-				warning("Game::drawSceneObjectMesh() unhandled primitive %d", primitive);
-				color = -1;
-				break;
-			}
-			if (color >= 0) {
-				_render->drawPolygonFlat(polygonPoints, count + 1, color);
-			}
+		} else {
+			_render->drawPolygonFlat(polygonPoints, p->verticesCount, p->color);
 		}
-		count = *polygonsData++;
-		color = READ_LE_UINT16(polygonsData); polygonsData += 2;
 	}
 }
 
@@ -2995,11 +3161,11 @@ void Game::redrawScene() {
 	redrawSceneGroundWalls();
 }
 
-void Game::drawWall(const Vertex *vertices, int verticesCount, int texture) {
+void Game::drawWall(const Vertex *vertices, int verticesCount, int texture, bool draw) {
 	texture &= 4095;
 	if (texture >= 0  && texture < 512) {
 		_sceneAnimationsTable[texture].type |= 0x10;
-		if (texture != 0 && texture != 1) {
+		if (draw && texture != 0 && texture != 1) {
 			SpriteImage *spr = &_sceneAnimationsTextureTable[texture];
 			if (spr->data) {
 				const uint8_t *texData = _spriteCache.getData(spr->key, spr->data);
@@ -3099,17 +3265,176 @@ static void initVerticesGround(Vertex *quad, int x, int z) {
 	quad[3].z = (z + 1) * 16;
 }
 
-bool Game::redrawSceneGridCell(int x, int z, CellMap *cell) {
+struct SceneCellQuad {
+	Vertex vertices[4];
+	int16_t texture;
+	uint8_t primitive;
+};
+
+static const int kSceneCellQuadsMax = 5;
+
+// ground and walls of a cell, -1 for the doors which are drawn every frame
+static int getSceneCellQuads(int x, int z, const CellMap *cell, int32_t ground, SceneCellQuad *quads) {
+	int count = 0;
+	if (cell->type != 32 && ground >= 0 && ground < 512) {
+		initVerticesGround(quads[count].vertices, x, z);
+		quads[count].texture = ground;
+		quads[count].primitive = 9;
+		++count;
+	}
+	if (cell->type <= 0) {
+		return count;
+	}
+	const int wallsStart = count;
+	switch (cell->type) {
+	case 1:
+		initVerticesW(quads[count].vertices, x, z, 0, 0);
+		quads[count++].texture = cell->west;
+		initVerticesS(quads[count].vertices, x, z, 0, 0);
+		quads[count++].texture = cell->south;
+		initVerticesE(quads[count].vertices, x, z, 0, 0);
+		quads[count++].texture = cell->east;
+		initVerticesN(quads[count].vertices, x, z, 0, 0);
+		quads[count++].texture = cell->north;
+		break;
+	case 3:
+		initVerticesS(quads[count].vertices, x, z, 0, 0);
+		quads[count++].texture = cell->texture[1];
+		initVerticesS(quads[count].vertices, x, z, 0, -kWallThick);
+		quads[count++].texture = cell->texture[0];
+		break;
+	case 10:
+		initVerticesE(quads[count].vertices, x, z,  kWallThick/2, 0);
+		quads[count++].texture = cell->texture[1];
+		initVerticesE(quads[count].vertices, x, z, -kWallThick/2, 0);
+		quads[count++].texture = cell->texture[0];
+		break;
+	case 11:
+		initVerticesN(quads[count].vertices, x, z, 0, -(16 - kWallThick) / 2);
+		quads[count++].texture = cell->texture[0];
+		initVerticesS(quads[count].vertices, x, z, 0,  (16 - kWallThick) / 2);
+		quads[count++].texture = cell->texture[1];
+		break;
+	case 20:
+	case 32:
+		break;
+	default:
+		return -1;
+	}
+	// same filtering as drawWall()
+	int wallsCount = wallsStart;
+	for (int i = wallsStart; i < count; ++i) {
+		const int texture = quads[i].texture & 4095;
+		if (texture < 512) {
+			quads[wallsCount] = quads[i];
+			quads[wallsCount].texture = texture;
+			quads[wallsCount].primitive = 0;
+			++wallsCount;
+		}
+	}
+	return wallsCount;
+}
+
+void Game::initStaticSceneQuads() {
+	int quadsCount = 0;
+	for (int x = 0; x < kMapSizeX; ++x) {
+		for (int z = 0; z < kMapSizeZ; ++z) {
+			CellMap *cell = &_sceneCellMap[x][z];
+			SceneCellQuad quads[kSceneCellQuadsMax];
+			const int count = getSceneCellQuads(x, z, cell, _sceneGroundMap[x][z], quads);
+			if (count < 0) {
+				cell->staticQuad = -1;
+				cell->staticQuadsCount = 0;
+			} else {
+				cell->staticQuad = quadsCount;
+				cell->staticQuadsCount = count;
+				quadsCount += count;
+			}
+		}
+	}
+	debug(kDebug_GAME, "Game::initStaticSceneQuads() quads %d", quadsCount);
+	memFree(_sceneStaticQuadsTable);
+	_sceneStaticQuadsTable = ALLOC_TAGGED<SceneStaticQuad>(kMemTag_GEOMETRY, quadsCount);
+	memFree(_sceneStaticQuadsMask);
+	_sceneStaticQuadsMask = ALLOC_TAGGED<uint8_t>(kMemTag_GEOMETRY, quadsCount);
+	_sceneStaticQuadsCount = quadsCount;
+	memset(_sceneStaticTextureQuad, -1, sizeof(_sceneStaticTextureQuad));
+	_render->initStaticQuads(quadsCount);
+	for (int x = 0; x < kMapSizeX; ++x) {
+		for (int z = 0; z < kMapSizeZ; ++z) {
+			const CellMap *cell = &_sceneCellMap[x][z];
+			if (cell->staticQuad < 0) {
+				continue;
+			}
+			SceneCellQuad quads[kSceneCellQuadsMax];
+			getSceneCellQuads(x, z, cell, _sceneGroundMap[x][z], quads);
+			for (int i = 0; i < cell->staticQuadsCount; ++i) {
+				const int num = cell->staticQuad + i;
+				SceneStaticQuad *sq = &_sceneStaticQuadsTable[num];
+				sq->texture = quads[i].texture;
+				sq->primitive = quads[i].primitive;
+				sq->next = _sceneStaticTextureQuad[sq->texture];
+				_sceneStaticTextureQuad[sq->texture] = num;
+				_render->setStaticQuad(num, quads[i].vertices);
+			}
+		}
+	}
+	// the quads are hidden until the first update
+	memset(_sceneStaticTextureData, 0, sizeof(_sceneStaticTextureData));
+	updateStaticSceneTextures();
+}
+
+void Game::updateStaticSceneTextures() {
+	for (int i = 2; i < 512; ++i) {
+		if (_sceneStaticTextureQuad[i] < 0) {
+			continue;
+		}
+		SpriteImage *spr = &_sceneAnimationsTextureTable[i];
+		if (spr->data == _sceneStaticTextureData[i]) {
+			continue;
+		}
+		_sceneStaticTextureData[i] = spr->data;
+		const uint8_t *texData = spr->data ? _spriteCache.getData(spr->key, spr->data) : 0;
+		for (int num = _sceneStaticTextureQuad[i]; num >= 0; num = _sceneStaticQuadsTable[num].next) {
+			const SceneStaticQuad *sq = &_sceneStaticQuadsTable[num];
+			if (sq->texture == i) {
+				_render->setStaticQuadTexture(num, sq->primitive, texData, spr->w, spr->h, spr->key);
+			}
+		}
+	}
+}
+
+// the cell geometry or textures are changed by a script, draw it every frame
+void Game::releaseStaticSceneCell(CellMap *cell) {
+	if (cell->staticQuad < 0) {
+		return;
+	}
+	for (int i = 0; i < cell->staticQuadsCount; ++i) {
+		const int num = cell->staticQuad + i;
+		_sceneStaticQuadsTable[num].texture = -1;
+		_render->setStaticQuadTexture(num, 0, 0, 0, 0, 0);
+	}
+	cell->staticQuad = -1;
+	cell->staticQuadsCount = 0;
+}
+
+// the animations of the cells in the frustum are updated, 'draw' is false for
+// the cells outside the potentially visible set
+void Game::redrawSceneGridCell(int x, int z, CellMap *cell, bool draw) {
+	if (cell->staticQuad >= 0) {
+		for (int i = 0; i < cell->staticQuadsCount; ++i) {
+			_sceneAnimationsTable[_sceneStaticQuadsTable[cell->staticQuad + i].texture].type |= 0x10;
+			_sceneStaticQuadsMask[cell->staticQuad + i] = draw;
+		}
+		return;
+	}
 	Vertex quad[4];
 	initVerticesGround(quad, x, z);
-	if (!_render->isQuadInFrustrum(quad, 4)) {
-		return false;
-	}
 	if (cell->type != 32) {
 		const int index = _sceneGroundMap[x][z];
 		if (index >= 0 && index < 512) {
 			_sceneAnimationsTable[index].type |= 0x10;
-			if (index != 0 && index != 1) {
+			if (draw && index != 0 && index != 1) {
 				SpriteImage *spr = &_sceneAnimationsTextureTable[index];
 				if (spr->data) {
 					const uint8_t *texData = _spriteCache.getData(spr->key, spr->data);
@@ -3123,63 +3448,63 @@ bool Game::redrawSceneGridCell(int x, int z, CellMap *cell) {
 		switch (cell->type) {
 		case 1:
 			initVerticesW(quad, x, z, 0, 0);
-			drawWall(quad, 4, cell->west);
+			drawWall(quad, 4, cell->west, draw);
 			initVerticesS(quad, x, z, 0, 0);
-			drawWall(quad, 4, cell->south);
+			drawWall(quad, 4, cell->south, draw);
 			initVerticesE(quad, x, z, 0, 0);
-			drawWall(quad, 4, cell->east);
+			drawWall(quad, 4, cell->east, draw);
 			initVerticesN(quad, x, z, 0, 0);
-			drawWall(quad, 4, cell->north);
+			drawWall(quad, 4, cell->north, draw);
 			break;
 		case 3:
 			initVerticesS(quad, x, z, 0, 0);
-			drawWall(quad, 4, cell->texture[1]);
+			drawWall(quad, 4, cell->texture[1], draw);
 			initVerticesS(quad, x, z, 0, -kWallThick);
-			drawWall(quad, 4, cell->texture[0]);
+			drawWall(quad, 4, cell->texture[0], draw);
 			break;
 		case 4:
 		case 16:
 			dz = -(63 - cell->data[1]) / 4;
 			initVerticesE(quad, x, z, 0, dz);
-			drawWall(quad, 4, cell->texture[1]);
+			drawWall(quad, 4, cell->texture[1], draw);
 			initVerticesE(quad, x, z, -kWallThick, dz);
-			drawWall(quad, 4, cell->texture[0]);
+			drawWall(quad, 4, cell->texture[0], draw);
 			break;
 		case 5:
 		case 17:
 			dz = (63 - cell->data[1]) / 4;
 			initVerticesE(quad, x, z, 0, dz);
-			drawWall(quad, 4, cell->texture[1]);
+			drawWall(quad, 4, cell->texture[1], draw);
 			initVerticesE(quad, x, z, -kWallThick, dz);
-			drawWall(quad, 4, cell->texture[0]);
+			drawWall(quad, 4, cell->texture[0], draw);
 			break;
 		case 6:
 		case 18:
 			dx = -(63 - cell->data[1]) / 4;
 			initVerticesN(quad, x, z, dx, -(16 - kWallThick) / 2);
-			drawWall(quad, 4, cell->texture[0]);
+			drawWall(quad, 4, cell->texture[0], draw);
 			initVerticesS(quad, x, z, dx,  (16 - kWallThick) / 2);
-			drawWall(quad, 4, cell->texture[1]);
+			drawWall(quad, 4, cell->texture[1], draw);
 			break;
 		case 7:
 		case 19:
 			dx = (63 - cell->data[1]) / 4;
 			initVerticesN(quad, x, z, dx, -(16 - kWallThick) / 2);
-			drawWall(quad, 4, cell->texture[0]);
+			drawWall(quad, 4, cell->texture[0], draw);
 			initVerticesS(quad, x, z, dx,  (16 - kWallThick) / 2);
-			drawWall(quad, 4, cell->texture[1]);
+			drawWall(quad, 4, cell->texture[1], draw);
 			break;
 		case 10:
 			initVerticesE(quad, x, z,  kWallThick/2, 0);
-			drawWall(quad, 4, cell->texture[1]);
+			drawWall(quad, 4, cell->texture[1], draw);
 			initVerticesE(quad, x, z, -kWallThick/2, 0);
-			drawWall(quad, 4, cell->texture[0]);
+			drawWall(quad, 4, cell->texture[0], draw);
 			break;
 		case 11:
 			initVerticesN(quad, x, z, 0, -(16 - kWallThick) / 2);
-			drawWall(quad, 4, cell->texture[0]);
+			drawWall(quad, 4, cell->texture[0], draw);
 			initVerticesS(quad, x, z, 0,  (16 - kWallThick) / 2);
-			drawWall(quad, 4, cell->texture[1]);
+			drawWall(quad, 4, cell->texture[1], draw);
 			break;
 		case 20:
 			break;
@@ -3190,39 +3515,142 @@ bool Game::redrawSceneGridCell(int x, int z, CellMap *cell) {
 			break;
 		}
 	}
-	return true;
+}
+
+// quadtree over the map, the blocks entirely in or out of the frustum are
+// classified with a single test
+// the quadtree nodes of this size are classified with the batched tests
+static const int kCullBlockSize = 4;
+
+void Game::cullSceneCells(int x, int z, int size) {
+	Vertex boxMin, boxMax;
+	boxMin.x = x * 16;
+	boxMin.y = 0;
+	boxMin.z = z * 16;
+	boxMax.x = (x + size) * 16;
+	boxMax.y = kGroundY;
+	boxMax.z = (z + size) * 16;
+	switch (_render->testBoxInFrustrum(&boxMin, &boxMax)) {
+	case kFrustrumOutside:
+		break;
+	case kFrustrumInside:
+		for (int i = 0; i < size; ++i) {
+			memset(&_sceneCellsVisibility[x + i][z], kCellVisible, size);
+		}
+		break;
+	case kFrustrumIntersect:
+		if (size <= kCullBlockSize) {
+			uint16_t cells[kCullBlockSize * kCullBlockSize];
+			int count = 0;
+			for (int i = 0; i < size; ++i) {
+				for (int j = 0; j < size; ++j) {
+					cells[count++] = (x + i) * kMapSizeZ + z + j;
+				}
+			}
+			cullSceneCellsBatch(cells, count);
+		} else {
+			size /= 2;
+			cullSceneCells(x, z, size);
+			cullSceneCells(x, z + size, size);
+			cullSceneCells(x + size, z, size);
+			cullSceneCells(x + size, z + size, size);
+		}
+		break;
+	}
+}
+
+// cells as x * kMapSizeZ + z
+void Game::cullSceneCellsBatch(const uint16_t *cells, int count) {
+	FrustumBoxes boxes;
+	boxes.count = count;
+	for (int i = 0; i < count; ++i) {
+		const int x = cells[i] / kMapSizeZ;
+		const int z = cells[i] % kMapSizeZ;
+		boxes.minX[i] = x * 16;
+		boxes.minY[i] = 0;
+		boxes.minZ[i] = z * 16;
+		boxes.maxX[i] = (x + 1) * 16;
+		boxes.maxY[i] = kGroundY;
+		boxes.maxZ[i] = (z + 1) * 16;
+	}
+	uint8_t results[kFrustrumBatchSize];
+	_render->testBoxesInFrustrum(&boxes, results);
+	// the ground is drawn if one of its corners is visible
+	float px[kFrustrumBatchSize * 4], py[kFrustrumBatchSize * 4], pz[kFrustrumBatchSize * 4];
+	uint16_t intersectCells[kFrustrumBatchSize];
+	int intersectCount = 0;
+	for (int i = 0; i < count; ++i) {
+		const int x = cells[i] / kMapSizeZ;
+		const int z = cells[i] % kMapSizeZ;
+		switch (results[i]) {
+		case kFrustrumInside:
+			_sceneCellsVisibility[x][z] = kCellVisible;
+			break;
+		case kFrustrumIntersect:
+			for (int j = 0; j < 4; ++j) {
+				const int k = intersectCount * 4 + j;
+				px[k] = (x + (j & 1)) * 16;
+				py[k] = kGroundY;
+				pz[k] = (z + (j >> 1)) * 16;
+			}
+			intersectCells[intersectCount++] = cells[i];
+			break;
+		}
+	}
+	uint8_t inside[kFrustrumBatchSize * 4];
+	_render->testPointsInFrustrum(px, py, pz, intersectCount * 4, inside);
+	for (int i = 0; i < intersectCount; ++i) {
+		const uint8_t *corners = &inside[i * 4];
+		const bool visible = corners[0] || corners[1] || corners[2] || corners[3];
+		_sceneCellsVisibility[intersectCells[i] / kMapSizeZ][intersectCells[i] % kMapSizeZ] = visible ? kCellVisible : kCellObjectsVisible;
+	}
+}
+
+void Game::redrawSceneCell(int x, int z, const ScenePvs *pvs) {
+	if (_sceneCellsVisibility[x][z] == kCellHidden) {
+		return;
+	}
+	CellMap *cell = &_sceneCellMap[x][z];
+	if (_sceneCellsVisibility[x][z] == kCellVisible) {
+		redrawSceneGridCell(x, z, cell, !pvs || pvs->cells[x * kMapSizeZ + z] != 0);
+	}
+	switch (cell->type) {
+	case 0:
+	case -2:
+	case -3:
+	case 32: // fixes objects on hole (level 4)
+		addObjectToDrawList(cell);
+		break;
+	}
 }
 
 void Game::redrawSceneGroundWalls() {
 //	rayCast(_xPosObserver << 1, _zPosObserver << 1);
 	_render->setupProjection();
 	_render->setupTexJobList();
+	updateStaticSceneTextures();
+	// on a fixed camera, the ground and walls hidden by the walls are not drawn. The
+	// objects list and the animations are updated from the frustum tests only, as
+	// they change the game state
+	const ScenePvs *pvs = getScenePvs();
+	if (pvs && _sceneStaticQuadsMask) {
+		memset(_sceneStaticQuadsMask, 0, _sceneStaticQuadsCount);
+	}
+	{
+		PROFILE_SCOPE(kProfPhase_cullSceneCells);
+		memset(_sceneCellsVisibility, kCellHidden, sizeof(_sceneCellsVisibility));
+		cullSceneCells(0, 0, kMapSizeX);
+	}
 	for (int x = 0; x < kMapSizeX; ++x) {
 		for (int z = 0; z < kMapSizeZ; ++z) {
-			CellMap *cell = &_sceneCellMap[x][z];
-			const bool visible = redrawSceneGridCell(x, z, cell);
-			if (!visible) {
-				Vertex quad[8];
-				initVerticesGround(&quad[0], x, z);
-				initVerticesGround(&quad[4], x, z);
-				for (int i = 0; i < 4; ++i) {
-					quad[i].y = 0;
-				}
-				if (!_render->isBoxInFrustrum(quad, 8)) {
-					continue;
-				}
-			}
-			switch (cell->type) {
-			case 0:
-			case -2:
-			case -3:
-			case 32: // fixes objects on hole (level 4)
-				addObjectToDrawList(cell);
-				break;
-			}
+			redrawSceneCell(x, z, pvs);
 		}
 	}
-	_render->flushTexJobList();
+	_render->drawStaticQuads(pvs ? _sceneStaticQuadsMask : 0);
+	if (!_render->_batchObjects) {
+		PROFILE_SCOPE(kProfPhase_flushTexJobList);
+		_render->flushTexJobList();
+	}
 }
 
 bool Game::findRoom(const CollisionSlot *colSlot, int room1, int room2) {
@@ -3481,69 +3909,48 @@ void Game::setupInventoryObjects() {
 }
 
 void Game::addParticle(int xPos, int yPos, int zPos, int rnd, int dx, int dy, int dz, int count, int ticks, int fl, int speed) {
-	const int particlesLeft = kParticlesTableSize - _particlesCount;
+	const int particlesLeft = kParticlesTableSize - _particles.count;
 	if (count > particlesLeft) {
 		count = particlesLeft;
 	}
-	assert(_particlesCount + count <= kParticlesTableSize);
-	for (int i = 0; i < count; ++i) {
-		Particle *part = &_particlesTable[_particlesCount + i];
-		memset(part, 0, sizeof(Particle));
-		part->xPos = xPos;
-		part->yPos = (kGroundY << 15) + yPos;
-		part->zPos = zPos;
-		part->dx = dx + _rnd.getRandomNumberShift(rnd);
-		part->dy = dy - _rnd.getRandomNumberShift(rnd);
-		part->dz = dz + _rnd.getRandomNumberShift(rnd);
-		part->ticks = ticks + (_rnd.getRandomNumber() >> 9);
-		part->fl = fl;
-		part->speed = speed;
-	}
-	_particlesCount += count;
+	assert(_particles.count + count <= kParticlesTableSize);
+	for (int i = _particles.count; i < _particles.count + count; ++i) {
+		_particles.xPos[i] = xPos;
+		_particles.yPos[i] = (kGroundY << 15) + yPos;
+		_particles.zPos[i] = zPos;
+		_particles.dx[i] = dx + _rnd.getRandomNumberShift(rnd);
+		_particles.dy[i] = dy - _rnd.getRandomNumberShift(rnd);
+		_particles.dz[i] = dz + _rnd.getRandomNumberShift(rnd);
+		_particles.ticks[i] = ticks + (_rnd.getRandomNumber() >> 9);
+		_particles.fl[i] = fl;
+		_particles.speed[i] = speed;
+	}
+	_particles.count += count;
 }
 
 void Game::updateParticles() {
-	for (int i = 0; i < _particlesCount; ) {
-		Particle *part = &_particlesTable[i];
-		--part->ticks;
-		if (part->ticks <= 0) {
-			--_particlesCount;
-			if (i < _particlesCount) {
-				_particlesTable[i] = _particlesTable[i + 1];
-			}
-		} else {
-			++i;
-		}
-	}
-	for (int i = 0; i < _particlesCount; ++i) {
-		Particle *part = &_particlesTable[i];
-		part->dy += 1 << 12;
-		if (part->yPos >= (kGroundY << 15)) {
-			part->yPos = kGroundY << 15;
-			part->dy = (-part->dy) >> 2;
-			part->dx >>= 1;
-			part->dz >>= 1;
-		}
-		part->xPos += part->dx;
-		part->yPos += part->dy;
-		part->zPos += part->dz;
-	}
+	Particles_update(&_particles, kGroundY << 15);
 }
 
 void Game::drawParticles() {
-	for (int i = 0; i < _particlesCount; ++i) {
-		Particle *part = &_particlesTable[i];
+	Vertex v[kParticlesTableSize];
+	uint8_t colors[kParticlesTableSize];
+	for (int i = 0; i < _particles.count; ++i) {
+		const int fl = _particles.fl[i];
 		int color;
-		if (part->fl & 0x8000) {
-			color = _mrkBuffer[254 + (part->fl & 255)];
+		if (fl & 0x8000) {
+			color = _mrkBuffer[254 + (fl & 255)];
 		} else {
-			color = _indirectPalette[part->fl & 15][0]; // TODO: pass true color
+			color = _indirectPalette[fl & 15][0]; // TODO: pass true color
 		}
-		Vertex v;
-		v.x = part->xPos >> kPosShift;
-		v.y = part->yPos >> kPosShift;
-		v.z = part->zPos >> kPosShift;
-		_render->drawParticle(&v, color);
+		assert(color >= 0 && color < 256);
+		colors[i] = color;
+		v[i].x = _particles.xPos[i] >> kPosShift;
+		v[i].y = _particles.yPos[i] >> kPosShift;
+		v[i].z = _particles.zPos[i] >> kPosShift;
+	}
+	if (_particles.count != 0) {
+		_render->drawParticles(v, colors, _particles.count);
 	}
 }
 
@@ -3689,7 +4096,7 @@ bool Game::sendMessage(int msg, int16_t destObjKey) {
 					}
 				}
 				if (!alreadyInList) {
-					GameMessage *m_new = (GameMessage *)calloc(1, sizeof(GameMessage));
+					GameMessage *m_new = (GameMessage *)memCalloc(kMemTag_MESSAGE, 1, sizeof(GameMessage));
 					m_new->next = o->msg;
 					o->msg = m_new;
 					m_new->objKey = _currentObject->objKey;
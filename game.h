@@ -11,6 +11,8 @@
 #include "resource.h"
 #include "sound.h"
 #include "spritecache.h"
+#include "meshcache.h"
+#include "particles.h"
 #include "random.h"
 #include "render.h"
 
@@ -41,7 +43,6 @@ enum {
 	kGunTicksTableSize = 8,
 	kPalKeysTableSize = 16,
 	kRoomsTableSize = 128,
-	kParticlesTableSize = 256,
 	kObjectKeysTableSize = 900,
 	kSceneObjectsTableSize = 64,
 	kChangedObjectsTableSize = 64,
@@ -105,6 +106,12 @@ enum {
 	kCheatLifeCounter = 1 << 0,
 };
 
+enum {
+	kCellHidden = 0,
+	kCellObjectsVisible, // the ground is out of the frustum but not the objects above
+	kCellVisible
+};
+
 struct CollisionSlot;
 
 struct CellMap {
@@ -120,6 +127,14 @@ struct CellMap {
 	bool fixed;
 	int16_t north, south, west, east;
 	CollisionSlot *colSlot;
+	int staticQuad; // first quad in the static geometry, -1 if the cell is drawn every frame
+	int staticQuadsCount;
+};
+
+struct SceneStaticQuad {
+	int16_t texture; // -1 once the cell is modified
+	uint8_t primitive;
+	int next; // next quad with the same texture
 };
 
 struct CameraPosMap {
@@ -127,6 +142,12 @@ struct CameraPosMap {
 	int32_t l_ry, r_ry;
 };
 
+struct ScenePvs {
+	uint8_t *cells; // [x * kMapSizeZ + z], non zero if the ground and walls can be seen
+	int cellsCount;
+	bool valid;
+};
+
 struct SpriteImage {
 	int16_t w, h;
 	uint8_t *data;
@@ -297,14 +318,6 @@ struct GameFollowingObject {
 	GameFollowingPoint points[kFollowingObjectPointsTableSize];
 };
 
-struct Particle {
-	int xPos, yPos, zPos;
-	int dx, dy, dz;
-	int fl;
-	int16_t ticks;
-	int16_t speed;
-};
-
 struct Font {
 	int h;
 	int w;
@@ -351,9 +364,17 @@ struct DrawBuffer {
 
 struct Render;
 
+enum {
+	kStateHashNone = 0,
+	kStateHashDump,  // writes the per tick hashes
+	kStateHashCheck  // compares against the hashes of a previous run
+};
+
 struct GameParams {
-	GameParams() : playDemo(false), levelNum(0), xPosConrad(0), zPosConrad(0), subtitles(false) {}
+	GameParams() : playDemo(false), recordDemo(false), stateHash(kStateHashNone), levelNum(0), xPosConrad(0), zPosConrad(0), subtitles(false) {}
 	bool playDemo;
+	bool recordDemo;
+	int stateHash;
 	int levelNum;
 	int xPosConrad, zPosConrad;
 	bool subtitles;
@@ -372,6 +393,7 @@ struct Game {
 	Render *_render;
 	GameParams _params;
 	SpriteCache _spriteCache;
+	MeshCache _meshCache;
 	Random _rnd;
 	int _cheats;
 
@@ -416,12 +438,19 @@ struct Game {
 	int16_t _palKeysTable[kPalKeysTableSize];
 	CellMap _sceneCellMap[64][64];
 	int32_t _sceneGroundMap[64][64];
+	uint8_t _sceneCellsVisibility[64][64];
 	int _sceneCamerasCount;
 	CameraPosMap _sceneCameraPosTable[256];
+	ScenePvs _scenePvsTable[256];
 	int _sceneAnimationsCount, _sceneAnimationsCount2;
 	SceneAnimation _sceneAnimationsTable[512];
 	SceneAnimationState _sceneAnimationsStateTable[512];
 	SpriteImage _sceneAnimationsTextureTable[512];
+	SceneStaticQuad *_sceneStaticQuadsTable;
+	uint8_t *_sceneStaticQuadsMask; // quads drawn on a fixed camera
+	int _sceneStaticQuadsCount;
+	int _sceneStaticTextureQuad[512];
+	const uint8_t *_sceneStaticTextureData[512];
 	int _sceneTexturesCount;
 	SceneTexture _sceneTexturesTable[256];
 	SpriteImage _sceneTextureImagesBuffer[256];
@@ -441,6 +470,18 @@ struct Game {
 	uint8_t _inputButtonKey[kInputKeySize];
 	bool _inputKeyAction, _inputKeyUse, _inputKeyJump;
 	int _demoInput;
+	int _demoTicksBase;
+	File *_demoRecordFp;
+	uint32_t _demoRecordMask;
+	File *_stateHashFp;
+	bool _stateHashDiverged;
+	struct {
+		bool enabled;
+		uint64_t fpsStartNs;
+		int framesCount;
+		int fps;
+		int tickUs;
+	} _perfHud;
 
 	bool _updatePalette;
 	uint8_t _screenPalette[256 * 3];
@@ -448,8 +489,7 @@ struct Game {
 	uint32_t _mrkBuffer[260];
 
 	int _particleDx, _particleDy, _particleDz, _particleRnd, _particleSpd;
-	int _particlesCount;
-	Particle _particlesTable[kParticlesTableSize];
+	ParticlesTable _particles;
 
 	int _playerMessagesCount;
 	GamePlayerMessage _playerMessagesTable[kPlayerMessagesTableSize];
@@ -553,6 +593,9 @@ struct Game {
 	void setPalette(int16_t key);
 	void updatePalette();
 	void loadSceneMap(int16_t key);
+	void initStaticSceneQuads();
+	void updateStaticSceneTextures();
+	void releaseStaticSceneCell(CellMap *cell);
 	bool updateSceneAnimationsKeyFrame(int rnd, int index, SceneAnimation *sa, SceneAnimationState *sas);
 	void updateSceneAnimations();
 	void getSceneTexture(int16_t key, int framesSkip, SpriteImage *spr);
@@ -601,8 +644,11 @@ struct Game {
 	void drawSceneObjectMesh(const uint8_t *polygonsData, const uint8_t *verticesData, int verticesCount);
 	void drawSceneObject(SceneObject *so);
 	void redrawScene();
-	void drawWall(const Vertex *vertices, int verticesCount, int texture);
-	bool redrawSceneGridCell(int x, int z, CellMap *cell);
+	void drawWall(const Vertex *vertices, int verticesCount, int texture, bool draw);
+	void redrawSceneGridCell(int x, int z, CellMap *cell, bool draw);
+	void cullSceneCells(int x, int z, int size);
+	void cullSceneCellsBatch(const uint16_t *cells, int count);
+	void redrawSceneCell(int x, int z, const ScenePvs *pvs);
 	void redrawSceneGroundWalls();
 	bool findRoom(const CollisionSlot *colSlot, int room1, int room2);
 	bool testObjectsRoom(int16_t obj1Key, int16_t obj2Key);
@@ -621,6 +667,7 @@ struct Game {
 	void sendShootMessageHelper(GameObject *o, int xPos, int zPos, int radius, int num);
 	void initViewport();
 	void drawInfoPanel();
+	void drawPerfHud();
 	void getCutsceneMessages(int num);
 	void playCutscene(int num);
 	void playDeathCutscene(int objKey);
@@ -675,6 +722,8 @@ struct Game {
 	// input.cpp
 	void updateInput();
 	void updateGameInput();
+	void initDemoRecord();
+	void recordDemoInput();
 	bool testInputKeyMask(int num, int dir, int button, int index) const;
 	bool testInputKeyMaskEq(int num, int dir, int button, int index) const;
 	bool testInputKeyMaskPrev(int num, int dir, int button, int index) const;
@@ -769,6 +818,13 @@ struct Game {
 	int op_isObjectConradNotVisible(int argc, int32_t *argv);
 	int op_stopSound(int argc, int32_t *argv);
 
+	// pvs.cpp
+	void castScenePvs(float ex, float ez, uint8_t visible[kMapSizeX][kMapSizeZ]);
+	void computeScenePvs(int camera);
+	void initScenePvs();
+	void invalidateScenePvs();
+	const ScenePvs *getScenePvs();
+
 	// raycast.cpp
 	void rayCastInit(int sx);
 	int rayCastCollisionCb1(GameObject *o, CellMap *cell, int ox, int oz);
@@ -782,6 +838,9 @@ struct Game {
 	// saveload.cpp
 	void saveGameState(int num);
 	void loadGameState(int num);
+	uint32_t getStateHash();
+	void initStateHash();
+	void updateStateHash();
 	void saveScreenshot(int num);
 };
 
@@ -0,0 +1,117 @@
+/*
+ * Fade To Black engine rewrite
+ * Copyright (C) 2006-2012 Gregory Montoir (cyx@users.sourceforge.net)
+ */
+
+#ifndef GLWRAP_H__
+#define GLWRAP_H__
+
+//
+// With F2B_PROFILE, the GL entry points used by the renderer are routed
+// through the profiler to count the calls per frame. To be included after
+// the GL headers.
+//
+
+#include "profiler.h"
+
+#ifdef F2B_PROFILE
+
+static inline int glTexelSize(GLenum format, GLenum type) {
+	switch (type) {
+	case GL_UNSIGNED_BYTE:
+		switch (format) {
+		case GL_RGBA:
+			return 4;
+		case GL_RGB:
+			return 3;
+		case GL_LUMINANCE_ALPHA:
+			return 2;
+		}
+		return 1;
+	case GL_FLOAT:
+		return 4;
+	}
+	return 2; // GL_UNSIGNED_SHORT_5_5_5_1, GL_UNSIGNED_SHORT_5_6_5, ...
+}
+
+#define glBindTexture(target, texture) \
+	(Profiler_countGLBindTexture(texture), glBindTexture(target, texture))
+#define glTexImage2D(target, level, internalFormat, w, h, border, format, type, pixels) \
+	(Profiler_countGL(kProfGL_texImage, (pixels) ? (w) * (h) * glTexelSize(format, type) : 0), glTexImage2D(target, level, internalFormat, w, h, border, format, type, pixels))
+#define glTexSubImage2D(target, level, x, y, w, h, format, type, pixels) \
+	(Profiler_countGL(kProfGL_texSubImage, (w) * (h) * glTexelSize(format, type)), glTexSubImage2D(target, level, x, y, w, h, format, type, pixels))
+#define glBufferData(target, size, data, usage) \
+	(Profiler_countGL(kProfGL_bufferData, size), glBufferData(target, size, data, usage))
+#define glBufferSubData(target, offset, size, data) \
+	(Profiler_countGL(kProfGL_bufferData, size), glBufferSubData(target, offset, size, data))
+#define glReadPixels(x, y, w, h, format, type, pixels) \
+	(Profiler_countGL(kProfGL_readPixels), glReadPixels(x, y, w, h, format, type, pixels))
+#define glGetFloatv(name, params) \
+	(Profiler_countGL(kProfGL_getFloatv), glGetFloatv(name, params))
+
+#define glDrawArrays(mode, first, count) \
+	(Profiler_countGL(kProfGL_drawArrays), glDrawArrays(mode, first, count))
+#define glDrawElements(mode, count, type, indices) \
+	(Profiler_countGL(kProfGL_drawElements), glDrawElements(mode, count, type, indices))
+#define glVertexPointer(size, type, stride, pointer) \
+	(Profiler_countGL(kProfGL_pointer), glVertexPointer(size, type, stride, pointer))
+#define glTexCoordPointer(size, type, stride, pointer) \
+	(Profiler_countGL(kProfGL_pointer), glTexCoordPointer(size, type, stride, pointer))
+#define glColorPointer(size, type, stride, pointer) \
+	(Profiler_countGL(kProfGL_pointer), glColorPointer(size, type, stride, pointer))
+#define glVertexAttribPointer(index, size, type, normalized, stride, pointer) \
+	(Profiler_countGL(kProfGL_pointer), glVertexAttribPointer(index, size, type, normalized, stride, pointer))
+
+#define glEnable(cap) \
+	(Profiler_countGL(kProfGL_state), glEnable(cap))
+#define glDisable(cap) \
+	(Profiler_countGL(kProfGL_state), glDisable(cap))
+#define glEnableClientState(array) \
+	(Profiler_countGL(kProfGL_state), glEnableClientState(array))
+#define glDisableClientState(array) \
+	(Profiler_countGL(kProfGL_state), glDisableClientState(array))
+#define glEnableVertexAttribArray(index) \
+	(Profiler_countGL(kProfGL_state), glEnableVertexAttribArray(index))
+#define glDisableVertexAttribArray(index) \
+	(Profiler_countGL(kProfGL_state), glDisableVertexAttribArray(index))
+
+#define glUseProgram(program) \
+	(Profiler_countGL(kProfGL_useProgram), glUseProgram(program))
+#define glBindBuffer(target, buffer) \
+	(Profiler_countGL(kProfGL_bindBuffer), glBindBuffer(target, buffer))
+
+#define glMatrixMode(mode) \
+	(Profiler_countGL(kProfGL_matrix), glMatrixMode(mode))
+#define glLoadIdentity() \
+	(Profiler_countGL(kProfGL_matrix), glLoadIdentity())
+#define glLoadMatrixf(m) \
+	(Profiler_countGL(kProfGL_matrix), glLoadMatrixf(m))
+#define glMultMatrixf(m) \
+	(Profiler_countGL(kProfGL_matrix), glMultMatrixf(m))
+#define glPushMatrix() \
+	(Profiler_countGL(kProfGL_matrix), glPushMatrix())
+#define glPopMatrix() \
+	(Profiler_countGL(kProfGL_matrix), glPopMatrix())
+#define glTranslatef(x, y, z) \
+	(Profiler_countGL(kProfGL_matrix), glTranslatef(x, y, z))
+#define glRotatef(a, x, y, z) \
+	(Profiler_countGL(kProfGL_matrix), glRotatef(a, x, y, z))
+#define glScalef(x, y, z) \
+	(Profiler_countGL(kProfGL_matrix), glScalef(x, y, z))
+#define glUniformMatrix4fv(location, count, transpose, value) \
+	(Profiler_countGL(kProfGL_matrix), glUniformMatrix4fv(location, count, transpose, value))
+#ifdef USE_GLES
+#define glOrthof(l, r, b, t, n, f) \
+	(Profiler_countGL(kProfGL_matrix), glOrthof(l, r, b, t, n, f))
+#define glFrustumf(l, r, b, t, n, f) \
+	(Profiler_countGL(kProfGL_matrix), glFrustumf(l, r, b, t, n, f))
+#else
+#define glOrtho(l, r, b, t, n, f) \
+	(Profiler_countGL(kProfGL_matrix), glOrtho(l, r, b, t, n, f))
+#define glFrustum(l, r, b, t, n, f) \
+	(Profiler_countGL(kProfGL_matrix), glFrustum(l, r, b, t, n, f))
+#endif
+
+#endif // F2B_PROFILE
+
+#endif // GLWRAP_H__
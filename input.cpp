@@ -3,8 +3,52 @@
  * Copyright (C) 2006-2012 Gregory Montoir (cyx@users.sourceforge.net)
  */
 
+#include "file.h"
 #include "game.h"
 
+// .DEM key codes, in the order of the getDemoInputMask() bits
+static const uint16_t _demoInputKeys[] = {
+	5, 51, 64, 70, 73, 74, 80, 81, 83, 144, 145
+};
+
+static uint32_t getDemoInputMask(const PlayerInput &inp) {
+	uint32_t mask = 0;
+	if (inp.shiftKey) {
+		mask |= 1 << 0;
+	}
+	if (inp.enterKey) {
+		mask |= 1 << 1;
+	}
+	if (inp.lookAtDir & kInputDirDown) {
+		mask |= 1 << 2;
+	}
+	if (inp.lookAtDir & kInputDirRight) {
+		mask |= 1 << 3;
+	}
+	if (inp.dirMask & kInputDirLeft) {
+		mask |= 1 << 4;
+	}
+	if (inp.dirMask & kInputDirDown) {
+		mask |= 1 << 5;
+	}
+	if (inp.dirMask & kInputDirRight) {
+		mask |= 1 << 6;
+	}
+	if (inp.dirMask & kInputDirUp) {
+		mask |= 1 << 7;
+	}
+	if (inp.spaceKey) {
+		mask |= 1 << 8;
+	}
+	if (inp.altKey) {
+		mask |= 1 << 9;
+	}
+	if (inp.ctrlKey) {
+		mask |= 1 << 10;
+	}
+	return mask;
+}
+
 void Game::updateInput() {
 	int currentInput = getCurrentInput();
 	const uint8_t inputKey0 = _inputsTable[currentInput].inputKey0;
@@ -125,8 +169,11 @@ void Game::updateGameInput() {
 		_inputDirKeyReleased[_inputsTable[i].inputKey0] = 0;
 		_inputDirKeyReleased[_inputsTable[i].inputKey1] = 0;
 	}
+	if (_demoRecordFp) {
+		recordDemoInput();
+	}
 	if (_res._demoInputDataSize != 0 && _demoInput < _res._demoInputDataSize) {
-		while (_ticks == _res._demoInputData[_demoInput].ticks) {
+		while (_ticks - _demoTicksBase == _res._demoInputData[_demoInput].ticks) {
 			const ResDemoInput *input = &_res._demoInputData[_demoInput];
 			switch (input->key) {
 			case 0:
@@ -202,6 +249,43 @@ void Game::updateGameInput() {
 		}
 	}
 	updateInput();
+	if (_demoRecordFp) {
+		_demoRecordMask = getDemoInputMask(inp);
+	}
+}
+
+void Game::initDemoRecord() {
+	if (_demoRecordFp) {
+		fileClose(_demoRecordFp);
+	}
+	char name[16];
+	snprintf(name, sizeof(name), "LEVEL%d.DEM", _level);
+	_demoRecordFp = fileOpen(name, 0, kFileType_DUMP, false);
+	if (!_demoRecordFp) {
+		warning("Unable to open '%s' for writing", name);
+		return;
+	}
+	const int header[] = { kDemoHeaderMagic, _level, _rnd._randSeed };
+	for (int i = 0; i < ARRAYSIZE(header); ++i) {
+		fileWriteUint32LE(_demoRecordFp, 0);
+		fileWriteUint16LE(_demoRecordFp, 0);
+		fileWriteUint16LE(_demoRecordFp, header[i]);
+	}
+	_demoRecordMask = 0;
+	debug(kDebug_INFO, "Recording inputs to '%s'", name);
+}
+
+void Game::recordDemoInput() {
+	// compared against the inputs left by the previous tick, as seen by the playback
+	const uint32_t mask = getDemoInputMask(inp);
+	const uint32_t changed = mask ^ _demoRecordMask;
+	for (int i = 0; i < ARRAYSIZE(_demoInputKeys); ++i) {
+		if (changed & (1 << i)) {
+			fileWriteUint32LE(_demoRecordFp, _ticks - _demoTicksBase);
+			fileWriteUint16LE(_demoRecordFp, _demoInputKeys[i]);
+			fileWriteUint16LE(_demoRecordFp, (mask >> i) & 1);
+		}
+	}
 }
 
 bool Game::testInputKeyMask(int num, int dir, int button, int index) const {
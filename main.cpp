@@ -202,6 +202,9 @@ int main(int argc, char *argv[]) {
 					case SDLK_i:
 						stub->queueKeyInput(kKeyCodeCheatLifeCounter, 1);
 						break;
+					case SDLK_p:
+						stub->queueKeyInput(kKeyCodePerfHud, 1);
+						break;
 					case SDLK_s:
 						stub->saveState(gSaveSlot);
 						break;
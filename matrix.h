@@ -0,0 +1,120 @@
+/*
+ * Fade To Black engine rewrite
+ * Copyright (C) 2006-2012 Gregory Montoir (cyx@users.sourceforge.net)
+ */
+
+#ifndef MATRIX_H__
+#define MATRIX_H__
+
+#include <math.h>
+#include "util.h"
+
+struct Vertex4f {
+	float x, y, z, w;
+
+	void normalize() {
+		const float len = sqrt(x * x + y * y + z * z);
+		x /= len;
+		y /= len;
+		z /= len;
+		w /= len;
+	}
+};
+
+// column-major, same layout as the OpenGL fixed-function matrices
+struct Matrix4f {
+	float t[16];
+
+	void identity() {
+		memset(t, 0, sizeof(t));
+		for (int i = 0; i < 4; ++i) {
+			t[i * 4 + i] = 1.;
+		}
+	}
+
+	// res = b * a
+	static void mul(const Matrix4f& a, const Matrix4f& b, Matrix4f &res) {
+		for (int i = 0; i < 16; ++i) {
+			const float *va = &a.t[i & 12];
+			const float *vb = &b.t[i &  3];
+			res.t[i] = va[0] * vb[0] + va[1] * vb[4] + va[2] * vb[8] + va[3] * vb[12];
+		}
+	}
+
+	// this = this * m, as glMultMatrixf
+	void mulRight(const Matrix4f &m) {
+		Matrix4f res;
+		mul(m, *this, res);
+		*this = res;
+	}
+
+	void translate(float x, float y, float z) {
+		for (int i = 0; i < 4; ++i) {
+			t[12 + i] += t[i] * x + t[4 + i] * y + t[8 + i] * z;
+		}
+	}
+
+	void scale(float x, float y, float z) {
+		for (int i = 0; i < 4; ++i) {
+			t[i] *= x;
+			t[4 + i] *= y;
+			t[8 + i] *= z;
+		}
+	}
+
+	void rotate(float a, float x, float y, float z) {
+		const float len = sqrt(x * x + y * y + z * z);
+		x /= len;
+		y /= len;
+		z /= len;
+		const float rad = a * M_PI / 180.;
+		const float c = cos(rad);
+		const float s = sin(rad);
+		const float ic = 1 - c;
+		Matrix4f r;
+		r.identity();
+		r.t[0] = x * x * ic + c;
+		r.t[1] = y * x * ic + z * s;
+		r.t[2] = x * z * ic - y * s;
+		r.t[4] = x * y * ic - z * s;
+		r.t[5] = y * y * ic + c;
+		r.t[6] = y * z * ic + x * s;
+		r.t[8] = x * z * ic + y * s;
+		r.t[9] = y * z * ic - x * s;
+		r.t[10] = z * z * ic + c;
+		mulRight(r);
+	}
+
+	void frustum(float l, float r, float b, float t_, float n, float f) {
+		Matrix4f m;
+		memset(m.t, 0, sizeof(m.t));
+		m.t[0] = 2 * n / (r - l);
+		m.t[5] = 2 * n / (t_ - b);
+		m.t[8] = (r + l) / (r - l);
+		m.t[9] = (t_ + b) / (t_ - b);
+		m.t[10] = -(f + n) / (f - n);
+		m.t[11] = -1;
+		m.t[14] = -2 * f * n / (f - n);
+		mulRight(m);
+	}
+
+	void ortho(float l, float r, float b, float t_, float n, float f) {
+		Matrix4f m;
+		m.identity();
+		m.t[0] = 2 / (r - l);
+		m.t[5] = 2 / (t_ - b);
+		m.t[10] = -2 / (f - n);
+		m.t[12] = -(r + l) / (r - l);
+		m.t[13] = -(t_ + b) / (t_ - b);
+		m.t[14] = -(f + n) / (f - n);
+		mulRight(m);
+	}
+
+	void perspective(float fovy, float aspect, float znear, float zfar) {
+		const float y = znear * tan(fovy * M_PI / 360.);
+		const float x = y * aspect;
+		frustum(-x, x, -y, y, znear, zfar);
+	}
+};
+
+#endif // MATRIX_H__
@@ -0,0 +1,161 @@
+/*
+ * Fade To Black engine rewrite
+ * Copyright (C) 2006-2012 Gregory Montoir (cyx@users.sourceforge.net)
+ */
+
+#include "meshcache.h"
+#include "render.h"
+
+MeshCache::MeshCache()
+	: _entriesCount(0), _hitsCount(0), _missesCount(0) {
+	memset(_entries, 0, sizeof(_entries));
+}
+
+MeshCache::~MeshCache() {
+	flush();
+}
+
+void MeshCache::flush() {
+	for (int i = 0; i < ARRAYSIZE(_entries); ++i) {
+		memFree(_entries[i].mesh);
+	}
+	memset(_entries, 0, sizeof(_entries));
+	_entriesCount = 0;
+}
+
+static int getFlatColor(int color, bool warn) {
+	const int primitive = color >> 8;
+	switch (primitive) {
+	case 0:
+	case 1:
+		return color & 255;
+	case 2:
+		return kFlatColorShadow;
+	case 3:
+		return kFlatColorLight;
+	case 4:
+		return kFlatColorGreen;
+	case 5:
+		return kFlatColorRed;
+	case 6:
+		return kFlatColorYellow;
+	case 7:
+		return kFlatColorBlue;
+	case 8:
+		return kFlatColorShadow;
+	case 9:
+		return kFlatColorLight9;
+	default:
+		if (warn) {
+			warning("MeshCache::decodeMesh() unhandled primitive %d", primitive);
+		}
+		return -1;
+	}
+}
+
+// returns the number of polygons, 'mesh' is only filled if not NULL
+static int parseMesh(const uint8_t *polygonsData, const uint8_t *verticesData, int verticesCount, Mesh *mesh, int *meshVerticesCount) {
+	if (polygonsData[0] & 0x80) {
+		const int shadowPolySize = -(int8_t)polygonsData[0];
+		polygonsData += shadowPolySize;
+	}
+	int polygonsCount = 0;
+	int verticesOffset = 0;
+	int count = *polygonsData++;
+	int color = READ_LE_UINT16(polygonsData); polygonsData += 2;
+	while (count != 0) {
+		const bool byteIndices = (count & 0x40) != 0;
+		count = (count & 15) + 1;
+		int indices[16];
+		for (int i = 0; i < count; ++i) {
+			if (byteIndices) {
+				indices[i] = *polygonsData++;
+			} else {
+				indices[i] = READ_LE_UINT16(polygonsData); polygonsData += 2;
+			}
+			if (indices[i] >= verticesCount) {
+				if (!mesh) {
+					warning("MeshCache::decodeMesh() invalid index %d in vertex buffer (size %d)", indices[i], verticesCount);
+				}
+				*meshVerticesCount = verticesOffset;
+				return polygonsCount;
+			}
+		}
+		const int fill = (color >> 8) & 31;
+		int type = -1;
+		if (fill == 8 || fill == 11 || fill == 12) {
+			type = kMeshPolygonTexture;
+		} else if (fill != 10) {
+			type = kMeshPolygonFlat;
+		}
+		if (type != -1) {
+			int polygonColor = (type == kMeshPolygonTexture) ? (color & 255) : getFlatColor(color, !mesh);
+			if (polygonColor >= 0) {
+				if (mesh) {
+					MeshPolygon *p = &mesh->polygons[polygonsCount];
+					p->type = type;
+					p->primitive = (color >> 13) & 7;
+					p->verticesCount = count;
+					p->color = polygonColor;
+					p->verticesOffset = verticesOffset;
+					for (int i = 0; i < count; ++i) {
+						mesh->vertices[verticesOffset + i] = READ_VERTEX32(verticesData + indices[i] * 4);
+					}
+				}
+				++polygonsCount;
+				verticesOffset += count;
+			}
+		}
+		count = *polygonsData++;
+		color = READ_LE_UINT16(polygonsData); polygonsData += 2;
+	}
+	*meshVerticesCount = verticesOffset;
+	return polygonsCount;
+}
+
+static Mesh *decodeMesh(const uint8_t *polygonsData, const uint8_t *verticesData, int verticesCount) {
+	int meshVerticesCount;
+	const int polygonsCount = parseMesh(polygonsData, verticesData, verticesCount, 0, &meshVerticesCount);
+	const int size = sizeof(Mesh) + polygonsCount * sizeof(MeshPolygon) + meshVerticesCount * sizeof(Vertex);
+	uint8_t *p = (uint8_t *)memAlloc(kMemTag_MESHCACHE, size);
+	if (!p) {
+		return 0;
+	}
+	Mesh *mesh = (Mesh *)p;
+	mesh->polygonsCount = polygonsCount;
+	mesh->vertices = (Vertex *)(p + sizeof(Mesh));
+	mesh->polygons = (MeshPolygon *)(mesh->vertices + meshVerticesCount);
+	parseMesh(polygonsData, verticesData, verticesCount, mesh, &meshVerticesCount);
+	return mesh;
+}
+
+static uint32_t hashMeshData(const uint8_t *polygonsData, const uint8_t *verticesData) {
+	const uintptr_t h = ((uintptr_t)polygonsData) ^ (((uintptr_t)verticesData) * 31);
+	return (uint32_t)(h ^ (h >> 9));
+}
+
+const Mesh *MeshCache::getMesh(const uint8_t *polygonsData, const uint8_t *verticesData, int verticesCount) {
+	static const int kMask = ARRAYSIZE(_entries) - 1;
+	int i = hashMeshData(polygonsData, verticesData) & kMask;
+	while (_entries[i].mesh) {
+		if (_entries[i].polygonsData == polygonsData && _entries[i].verticesData == verticesData) {
+			++_hitsCount;
+			return _entries[i].mesh;
+		}
+		i = (i + 1) & kMask;
+	}
+	++_missesCount;
+	if (_entriesCount >= ARRAYSIZE(_entries) / 2) {
+		warning("MeshCache::getMesh() flushing %d entries", _entriesCount);
+		flush();
+		i = hashMeshData(polygonsData, verticesData) & kMask;
+	}
+	Mesh *mesh = decodeMesh(polygonsData, verticesData, verticesCount);
+	if (mesh) {
+		_entries[i].polygonsData = polygonsData;
+		_entries[i].verticesData = verticesData;
+		_entries[i].mesh = mesh;
+		++_entriesCount;
+	}
+	return mesh;
+}
@@ -0,0 +1,48 @@
+/*
+ * Fade To Black engine rewrite
+ * Copyright (C) 2006-2012 Gregory Montoir (cyx@users.sourceforge.net)
+ */
+
+#ifndef MESHCACHE_H__
+#define MESHCACHE_H__
+
+#include "util.h"
+
+enum {
+	kMeshPolygonFlat,
+	kMeshPolygonTexture
+};
+
+struct MeshPolygon {
+	uint8_t type;
+	uint8_t primitive;
+	uint8_t verticesCount;
+	int16_t color; // texture number or flat color
+	int verticesOffset;
+};
+
+// the polygons of a F3D model with their vertices unrolled
+struct Mesh {
+	int polygonsCount;
+	MeshPolygon *polygons;
+	Vertex *vertices;
+};
+
+struct MeshCache {
+	struct {
+		const uint8_t *polygonsData;
+		const uint8_t *verticesData;
+		Mesh *mesh;
+	} _entries[512];
+	int _entriesCount;
+	int _hitsCount, _missesCount;
+
+	MeshCache();
+	~MeshCache();
+
+	void flush();
+
+	const Mesh *getMesh(const uint8_t *polygonsData, const uint8_t *verticesData, int verticesCount);
+};
+
+#endif // MESHCACHE_H__
@@ -3,63 +3,15 @@
  * Copyright (C) 2006-2012 Gregory Montoir (cyx@users.sourceforge.net)
  */
 
+#include "decoder.h"
 #include "file.h"
 #include "mixer.h"
 #include "render.h"
 
-static const int16_t _delta16Table[128] = {
-	    0,      1,      2,      3,      4,      5,      6,      7,
-	    8,      9,     10,     11,     12,     13,     14,     15,
-	   17,     18,     20,     21,     23,     25,     27,     30,
-	   32,     35,     38,     41,     45,     49,     53,     58,
-	   62,     68,     74,     80,     87,     94,    102,    111,
-	  120,    130,    141,    153,    166,    181,    196,    212,
-	  230,    250,    271,    294,    319,    346,    376,    407,
-	  442,    479,    520,    564,    612,    663,    720,    781,
-	  847,    918,    996,   1080,   1172,   1271,   1379,   1495,
-	 1622,   1759,   1908,   2070,   2245,   2435,   2641,   2865,
-	 3107,   3370,   3655,   3964,   4300,   4664,   5059,   5487,
-	 5951,   6455,   7001,   7593,   8236,   8933,   9689,  10508,
-	11398,  12362,  13408,  14543,  15774,  17108,  18556,  20126,
-	21829,  23677,  25680,  27853,  30210,      0,      0,      0,
-            0,      0,      0,      0,      0,      0,      0,      0,
-            0,      0,      0,      0,      0,      0,      0,      0
-};
-
 static int clipS16(int sample) {
 	return CLIP(sample, -32768, 32767);
 }
 
-struct Delta16Decoder {
-	int _firstSample;
-	int _delta;
-
-	Delta16Decoder()
-		: _firstSample(0), _delta(0) {
-	}
-
-	int decode(uint8_t data) {
-		switch (_firstSample) {
-		case 0:
-			_delta = data;
-			_firstSample = 1;
-			break;
-		case 1:
-			_delta = (int16_t)((data << 8) | _delta);
-			_firstSample = 2;
-			break;
-		default:
-			if (data & (1 << 7)) {
-				_delta += _delta16Table[data - 128];
-			} else {
-				_delta -= _delta16Table[127 - data];
-			}
-			break;
-		}
-		return _firstSample == 1 ? 0 : clipS16(_delta);
-	}
-};
-
 struct SoundDataWav {
 	int _bufSize;
 	uint8_t *_buf;
@@ -69,6 +21,9 @@ struct SoundDataWav {
 	SoundDataWav()
 		: _bufSize(0), _buf(0) {
 	}
+	~SoundDataWav() {
+		memFree(_buf);
+	}
 
 	bool load(File *fp, int dataSize, int mixerSampleRate) {
 		const int pos = fileGetPos(fp);
@@ -104,7 +59,7 @@ struct SoundDataWav {
 		assert(dataSize > headerSize);
 		_bufSize = dataSize - headerSize;
 		debug(kDebug_SOUND, "chunk size %d header size %d buf size %d", chunkSize, headerSize, _bufSize);
-		_buf = (uint8_t *)malloc(_bufSize);
+		_buf = (uint8_t *)memAlloc(kMemTag_MIXER, _bufSize);
 		if (_buf) {
 			fileRead(fp, _buf, _bufSize);
 		}
@@ -125,6 +80,8 @@ struct MixerSound {
 	int volumeL;
 	int volumeR;
 
+	MEM_TAGGED_NEW(kMemTag_MIXER)
+
 	bool read(int16_t *dst, int len) {
 		int sample;
 		assert((len & 1) == 0);
@@ -157,6 +114,8 @@ struct MixerQueueList {
 	int size;
 	int read;
 	struct MixerQueueList *next;
+
+	MEM_TAGGED_NEW(kMemTag_MIXER)
 };
 
 struct MixerQueue {
@@ -164,6 +123,8 @@ struct MixerQueue {
 	int size;
 	int preloadSize;
 	MixerQueueList *head;
+
+	MEM_TAGGED_NEW(kMemTag_MIXER)
 };
 
 static void nullMixerLock(int lock) {
@@ -252,6 +213,17 @@ bool Mixer::isWavPlaying(uint32_t id) const {
 	return i != -1;
 }
 
+int Mixer::getActiveVoicesCount() const {
+	MixerLock ml(_lock);
+	int count = (_queue != 0) ? 1 : 0;
+	for (int i = 0; i < kMaxSoundsCount; ++i) {
+		if (_soundsTable[i]) {
+			++count;
+		}
+	}
+	return count;
+}
+
 void Mixer::playQueue(int preloadSize) {
 	stopQueue();
 	MixerLock ml(_lock);
@@ -266,7 +238,7 @@ void Mixer::appendToQueue(const uint8_t *buf, int size) {
 	MixerQueue *mq = _queue;
 	if (mq) {
 		MixerQueueList *mql = new MixerQueueList;
-		mql->buffer = (uint8_t *)malloc(size);
+		mql->buffer = (uint8_t *)memAlloc(kMemTag_MIXER, size);
 		memcpy(mql->buffer, buf, size);
 		mql->read = 0;
 		mql->size = size;
@@ -292,7 +264,7 @@ void Mixer::stopQueue() {
 		MixerQueueList *mql = _queue->head;
 		while (mql) {
 			MixerQueueList *next = mql->next;
-			free(mql->buffer);
+			memFree(mql->buffer);
 			delete mql;
 			mql = next;
 		}
@@ -326,7 +298,7 @@ void Mixer::mixBuf(int16_t *buf, int len) {
 			mix(&buf[i + 1], sample, kDefaultVolume);
 			if (mql->read >= mql->size) {
 				MixerQueueList *next = mql->next;
-				free(mql->buffer);
+				memFree(mql->buffer);
 				delete mql;
 				mql = next;
 				_queue->head = mql;
@@ -37,6 +37,7 @@ struct Mixer {
 	void playWav(File *, int dataSize, int volume, int pan, uint32_t id, bool compressed = true);
 	void stopWav(uint32_t);
 	bool isWavPlaying(uint32_t) const;
+	int getActiveVoicesCount() const;
 
 	void playQueue(int preloadSize);
 	void appendToQueue(const uint8_t *buf, int size);
@@ -987,8 +987,12 @@ int Game::op_setCellMapData(int argc, int32_t *argv) {
 	int32_t x = argv[2];
 	int32_t z = argv[3];
 	CellMap *cell = getCellMap(x, z);
+	releaseStaticSceneCell(cell);
 	switch (param) {
 	case 262:
+		if (cell->type == 1 || value == 1) {
+			invalidateScenePvs();
+		}
 		cell->type = value;
 		break;
 	case 263:
@@ -1018,6 +1022,7 @@ int Game::op_addCellMapData(int argc, int32_t *argv) {
 	int32_t x = argv[2];
 	int32_t z = argv[3];
 	CellMap *cell = getCellMap(x, z);
+	releaseStaticSceneCell(cell);
 	switch (param) {
 	case 263:
 		cell->data[0] += value;
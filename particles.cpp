@@ -0,0 +1,123 @@
+/*
+ * Fade To Black engine rewrite
+ * Copyright (C) 2006-2012 Gregory Montoir (cyx@users.sourceforge.net)
+ */
+
+#include "particles.h"
+#include "simd.h"
+
+//
+// The positions and speeds of 4 particles are updated per iteration with
+// SSE2 or NEON, the particles on the ground are selected with a mask. The
+// shifts are arithmetic in both versions, the results are the same.
+//
+
+static const int32_t kGravity = 1 << 12;
+
+void Particles_remove(ParticlesTable *particles, int i) {
+	const int last = --particles->count;
+	if (i < last) {
+		particles->xPos[i] = particles->xPos[last];
+		particles->yPos[i] = particles->yPos[last];
+		particles->zPos[i] = particles->zPos[last];
+		particles->dx[i] = particles->dx[last];
+		particles->dy[i] = particles->dy[last];
+		particles->dz[i] = particles->dz[last];
+		particles->fl[i] = particles->fl[last];
+		particles->ticks[i] = particles->ticks[last];
+		particles->speed[i] = particles->speed[last];
+	}
+}
+
+static void updateParticle(ParticlesTable *particles, int i, int32_t groundY) {
+	particles->dy[i] += kGravity;
+	if (particles->yPos[i] >= groundY) {
+		particles->yPos[i] = groundY;
+		particles->dy[i] = (-particles->dy[i]) >> 2;
+		particles->dx[i] >>= 1;
+		particles->dz[i] >>= 1;
+	}
+	particles->xPos[i] += particles->dx[i];
+	particles->yPos[i] += particles->dy[i];
+	particles->zPos[i] += particles->dz[i];
+}
+
+#if defined(F2B_SSE2)
+
+static inline __m128i selectLanes(__m128i mask, __m128i a, __m128i b) {
+	return _mm_or_si128(_mm_and_si128(mask, a), _mm_andnot_si128(mask, b));
+}
+
+static void updateParticles4(ParticlesTable *particles, int i, int32_t groundY) {
+	const __m128i ground = _mm_set1_epi32(groundY);
+	__m128i x = _mm_loadu_si128((const __m128i *)&particles->xPos[i]);
+	__m128i y = _mm_loadu_si128((const __m128i *)&particles->yPos[i]);
+	__m128i z = _mm_loadu_si128((const __m128i *)&particles->zPos[i]);
+	__m128i dx = _mm_loadu_si128((const __m128i *)&particles->dx[i]);
+	__m128i dy = _mm_loadu_si128((const __m128i *)&particles->dy[i]);
+	__m128i dz = _mm_loadu_si128((const __m128i *)&particles->dz[i]);
+	dy = _mm_add_epi32(dy, _mm_set1_epi32(kGravity));
+	const __m128i above = _mm_cmplt_epi32(y, ground);
+	y = selectLanes(above, y, ground);
+	dy = selectLanes(above, dy, _mm_srai_epi32(_mm_sub_epi32(_mm_setzero_si128(), dy), 2));
+	dx = selectLanes(above, dx, _mm_srai_epi32(dx, 1));
+	dz = selectLanes(above, dz, _mm_srai_epi32(dz, 1));
+	_mm_storeu_si128((__m128i *)&particles->xPos[i], _mm_add_epi32(x, dx));
+	_mm_storeu_si128((__m128i *)&particles->yPos[i], _mm_add_epi32(y, dy));
+	_mm_storeu_si128((__m128i *)&particles->zPos[i], _mm_add_epi32(z, dz));
+	_mm_storeu_si128((__m128i *)&particles->dx[i], dx);
+	_mm_storeu_si128((__m128i *)&particles->dy[i], dy);
+	_mm_storeu_si128((__m128i *)&particles->dz[i], dz);
+}
+
+#elif defined(F2B_NEON)
+
+static void updateParticles4(ParticlesTable *particles, int i, int32_t groundY) {
+	const int32x4_t ground = vdupq_n_s32(groundY);
+	int32x4_t x = vld1q_s32(&particles->xPos[i]);
+	int32x4_t y = vld1q_s32(&particles->yPos[i]);
+	int32x4_t z = vld1q_s32(&particles->zPos[i]);
+	int32x4_t dx = vld1q_s32(&particles->dx[i]);
+	int32x4_t dy = vld1q_s32(&particles->dy[i]);
+	int32x4_t dz = vld1q_s32(&particles->dz[i]);
+	dy = vaddq_s32(dy, vdupq_n_s32(kGravity));
+	const uint32x4_t above = vcltq_s32(y, ground);
+	y = vbslq_s32(above, y, ground);
+	dy = vbslq_s32(above, dy, vshrq_n_s32(vnegq_s32(dy), 2));
+	dx = vbslq_s32(above, dx, vshrq_n_s32(dx, 1));
+	dz = vbslq_s32(above, dz, vshrq_n_s32(dz, 1));
+	vst1q_s32(&particles->xPos[i], vaddq_s32(x, dx));
+	vst1q_s32(&particles->yPos[i], vaddq_s32(y, dy));
+	vst1q_s32(&particles->zPos[i], vaddq_s32(z, dz));
+	vst1q_s32(&particles->dx[i], dx);
+	vst1q_s32(&particles->dy[i], dy);
+	vst1q_s32(&particles->dz[i], dz);
+}
+
+#else
+
+static void updateParticles4(ParticlesTable *particles, int i, int32_t groundY) {
+	for (int k = 0; k < 4; ++k) {
+		updateParticle(particles, i + k, groundY);
+	}
+}
+
+#endif
+
+void Particles_update(ParticlesTable *particles, int32_t groundY) {
+	for (int i = 0; i < particles->count; ) {
+		--particles->ticks[i];
+		if (particles->ticks[i] <= 0) {
+			Particles_remove(particles, i);
+		} else {
+			++i;
+		}
+	}
+	int i = 0;
+	for (; i + 4 <= particles->count; i += 4) {
+		updateParticles4(particles, i, groundY);
+	}
+	for (; i < particles->count; ++i) {
+		updateParticle(particles, i, groundY);
+	}
+}
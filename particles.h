@@ -0,0 +1,28 @@
+/*
+ * Fade To Black engine rewrite
+ * Copyright (C) 2006-2012 Gregory Montoir (cyx@users.sourceforge.net)
+ */
+
+#ifndef PARTICLES_H__
+#define PARTICLES_H__
+
+#include "util.h"
+
+static const int kParticlesTableSize = 256;
+
+// the particles as structure of arrays, a removed particle is replaced by the last one
+struct ParticlesTable {
+	int count;
+	int32_t xPos[kParticlesTableSize], yPos[kParticlesTableSize], zPos[kParticlesTableSize];
+	int32_t dx[kParticlesTableSize], dy[kParticlesTableSize], dz[kParticlesTableSize];
+	int32_t fl[kParticlesTableSize];
+	int16_t ticks[kParticlesTableSize];
+	int16_t speed[kParticlesTableSize];
+};
+
+void Particles_remove(ParticlesTable *particles, int i);
+
+// removes the expired particles, applies the gravity and the bounces on the ground
+void Particles_update(ParticlesTable *particles, int32_t groundY);
+
+#endif // PARTICLES_H__
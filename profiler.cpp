@@ -0,0 +1,328 @@
+/*
+ * Fade To Black engine rewrite
+ * Copyright (C) 2006-2012 Gregory Montoir (cyx@users.sourceforge.net)
+ */
+
+#include "profiler.h"
+
+#ifdef F2B_PROFILE
+
+#include "file.h"
+
+static const char *_phaseNames[] = {
+	"doTick",
+	"updateSceneAnimations",
+	"updateSceneTextures",
+	"updatePlayerObject",
+	"redrawScene",
+	"updateChangedObjects",
+	"addObjectsToScene",
+	"runObject",
+	"updateCollidingObjects",
+	"drawInfoPanel",
+	"flushTexJobList",
+	"cullSceneCells"
+};
+
+struct ProfileSample {
+	uint64_t startNs;
+	uint32_t durationNs;
+	uint32_t tick;
+	int phase;
+};
+
+// single producer (the game thread), the write index is published after the
+// sample is stored so that a reader never sees a partially written entry
+static const int kSamplesCount = 1 << 16;
+static ProfileSample _samples[kSamplesCount];
+static uint32_t _samplesHead;
+
+static uint32_t _tick;
+static int _output = -1;
+static uint64_t _originNs;
+
+struct ProfileCounter {
+	uint32_t key;
+	char name[24];
+	uint32_t count;
+	uint64_t totalNs;
+};
+
+// open addressing, keyed by opcode, CMD script number or object name hash
+static const int kCountersTableSize = 2048;
+static const int kReportLinesCount = 16;
+static ProfileCounter _counters[kProfCountersCount][kCountersTableSize];
+static const char *_counterNames[] = { "opcode", "script", "object" };
+static bool _scriptsEnabled;
+static int _scriptsLevel;
+static const char *const *_opcodeNames;
+static int _opcodeNamesCount;
+
+static const char *_glCounterNames[] = {
+	"bindTexture",
+	"bindTextureRedundant",
+	"texImage",
+	"texSubImage",
+	"bufferData",
+	"uploadBytes",
+	"drawArrays",
+	"drawElements",
+	"pointer",
+	"state",
+	"useProgram",
+	"bindBuffer",
+	"matrix",
+	"getFloatv",
+	"readPixels"
+};
+
+struct ProfileGLFrame {
+	uint64_t endNs;
+	uint32_t tick;
+	uint32_t counters[kProfGLCountersCount];
+};
+
+// the GL calls are issued from the game thread only
+static const int kGLFramesCount = 1 << 12;
+static ProfileGLFrame _glFrames[kGLFramesCount];
+static uint32_t _glFramesHead;
+static uint32_t _glCounters[kProfGLCountersCount];
+static uint64_t _glTotals[kProfGLCountersCount];
+static uint32_t _glMax[kProfGLCountersCount];
+static unsigned int _glBoundTexture;
+
+ProfileScope::ProfileScope(int phase)
+	: _phase(phase) {
+	_startNs = getTimeNs();
+}
+
+ProfileScope::~ProfileScope() {
+	const uint64_t endNs = getTimeNs();
+	const uint32_t head = __atomic_load_n(&_samplesHead, __ATOMIC_RELAXED);
+	ProfileSample *s = &_samples[head & (kSamplesCount - 1)];
+	s->startNs = _startNs;
+	s->durationNs = (uint32_t)(endNs - _startNs);
+	s->tick = _tick;
+	s->phase = _phase;
+	__atomic_store_n(&_samplesHead, head + 1, __ATOMIC_RELEASE);
+}
+
+ProfileCounterScope::ProfileCounterScope(int counter, uint32_t key, const char *name)
+	: _counter(counter), _key(key), _name(name), _startNs(0) {
+	if (_scriptsEnabled) {
+		_startNs = getTimeNs();
+	}
+}
+
+ProfileCounterScope::~ProfileCounterScope() {
+	if (_startNs == 0) {
+		return;
+	}
+	const uint64_t dt = getTimeNs() - _startNs;
+	const uint32_t key = _name ? getStringHash(_name) : _key;
+	ProfileCounter *table = _counters[_counter];
+	for (int i = 0; i < kCountersTableSize; ++i) {
+		ProfileCounter *c = &table[(key + i) & (kCountersTableSize - 1)];
+		if (c->count == 0) {
+			c->key = key;
+			if (_name) {
+				strncpy(c->name, _name, sizeof(c->name) - 1);
+			}
+		} else if (c->key != key || (_name && strncmp(c->name, _name, sizeof(c->name) - 1) != 0)) {
+			continue;
+		}
+		++c->count;
+		c->totalNs += dt;
+		return;
+	}
+	warning("Profiler counters table '%s' full", _counterNames[_counter]);
+}
+
+void Profiler_enableScripts() {
+	_scriptsEnabled = true;
+}
+
+void Profiler_setOpcodeNames(const char *const *names, int count) {
+	_opcodeNames = names;
+	_opcodeNamesCount = count;
+}
+
+static int compareCounters(const void *a, const void *b) {
+	const uint64_t ta = ((const ProfileCounter *)a)->totalNs;
+	const uint64_t tb = ((const ProfileCounter *)b)->totalNs;
+	return (ta > tb) ? -1 : (ta < tb) ? 1 : 0;
+}
+
+void Profiler_setScriptsLevel(int level) {
+	_scriptsLevel = level;
+}
+
+void Profiler_printScriptsReport() {
+	if (!_scriptsEnabled) {
+		return;
+	}
+	for (int i = 0; i < kProfCountersCount; ++i) {
+		ProfileCounter *table = _counters[i];
+		int count = 0;
+		uint64_t totalNs = 0;
+		for (int j = 0; j < kCountersTableSize; ++j) {
+			if (table[j].count != 0) {
+				totalNs += table[j].totalNs;
+				table[count++] = table[j];
+			}
+		}
+		if (count == 0) {
+			continue;
+		}
+		qsort(table, count, sizeof(ProfileCounter), compareCounters);
+		fprintf(stdout, "level %d %s profile, %d entries, %.3f ms\n", _scriptsLevel, _counterNames[i], count, totalNs / 1e6);
+		for (int j = 0; j < count && j < kReportLinesCount; ++j) {
+			const ProfileCounter *c = &table[j];
+			char name[32];
+			switch (i) {
+			case kProfCounter_opcode:
+				snprintf(name, sizeof(name), "%d %s", c->key, (c->key < (uint32_t)_opcodeNamesCount) ? _opcodeNames[c->key] : "");
+				break;
+			case kProfCounter_script:
+				snprintf(name, sizeof(name), "%d", c->key);
+				break;
+			default:
+				snprintf(name, sizeof(name), "%s", c->name);
+				break;
+			}
+			fprintf(stdout, "  %-32s calls %8d total %9.3f ms avg %8.3f us %5.1f%%\n", name, c->count, c->totalNs / 1e6, c->totalNs / 1e3 / c->count, c->totalNs * 100. / totalNs);
+		}
+		memset(table, 0, sizeof(ProfileCounter) * kCountersTableSize);
+	}
+	fflush(stdout);
+}
+
+void Profiler_countGL(int counter, int uploadBytes) {
+	++_glCounters[counter];
+	_glCounters[kProfGL_uploadBytes] += uploadBytes;
+}
+
+void Profiler_countGLBindTexture(unsigned int texture) {
+	++_glCounters[kProfGL_bindTexture];
+	if (texture == _glBoundTexture) {
+		++_glCounters[kProfGL_bindTextureRedundant];
+	}
+	_glBoundTexture = texture;
+}
+
+void Profiler_endFrameGL() {
+	ProfileGLFrame *f = &_glFrames[_glFramesHead & (kGLFramesCount - 1)];
+	f->endNs = getTimeNs();
+	f->tick = _tick;
+	for (int i = 0; i < kProfGLCountersCount; ++i) {
+		f->counters[i] = _glCounters[i];
+		_glTotals[i] += _glCounters[i];
+		_glMax[i] = MAX(_glMax[i], _glCounters[i]);
+		_glCounters[i] = 0;
+	}
+	++_glFramesHead;
+}
+
+void Profiler_printGLReport() {
+	if (_glFramesHead == 0) {
+		return;
+	}
+	fprintf(stdout, "gl profile, %d frames\n", _glFramesHead);
+	for (int i = 0; i < kProfGLCountersCount; ++i) {
+		fprintf(stdout, "  %-24s total %12llu avg/frame %10.1f max/frame %8u\n", _glCounterNames[i], (unsigned long long)_glTotals[i], _glTotals[i] / (double)_glFramesHead, _glMax[i]);
+	}
+	fflush(stdout);
+}
+
+void Profiler_init(int output) {
+	_output = output;
+	_originNs = getTimeNs();
+	_samplesHead = 0;
+}
+
+void Profiler_setTick(uint32_t tick) {
+	_tick = tick;
+}
+
+static void writeString(File *fp, const char *fmt, ...) {
+	char buf[256];
+	va_list va;
+	va_start(va, fmt);
+	const int len = vsnprintf(buf, sizeof(buf), fmt, va);
+	va_end(va);
+	fileWrite(fp, buf, MIN(len, (int)sizeof(buf) - 1));
+}
+
+static void dumpGLFrames(const char *fileName) {
+	File *fp = fileOpen(fileName, 0, kFileType_DUMP, false);
+	if (!fp) {
+		warning("Unable to open '%s' for writing", fileName);
+		return;
+	}
+	writeString(fp, "frame,tick");
+	for (int i = 0; i < kProfGLCountersCount; ++i) {
+		writeString(fp, ",%s", _glCounterNames[i]);
+	}
+	writeString(fp, "\n");
+	const uint32_t first = (_glFramesHead > (uint32_t)kGLFramesCount) ? _glFramesHead - kGLFramesCount : 0;
+	for (uint32_t i = first; i < _glFramesHead; ++i) {
+		const ProfileGLFrame *f = &_glFrames[i & (kGLFramesCount - 1)];
+		writeString(fp, "%u,%u", i, f->tick);
+		for (int j = 0; j < kProfGLCountersCount; ++j) {
+			writeString(fp, ",%u", f->counters[j]);
+		}
+		writeString(fp, "\n");
+	}
+	fileClose(fp);
+	debug(kDebug_INFO, "Wrote %d GL frames to '%s'", _glFramesHead - first, fileName);
+}
+
+void Profiler_dump() {
+	if (_output < 0) {
+		return;
+	}
+	const char *fileName = (_output == kProfOutput_TRACE) ? "f2bgl-profile.json" : "f2bgl-profile.csv";
+	File *fp = fileOpen(fileName, 0, kFileType_DUMP, false);
+	if (!fp) {
+		warning("Unable to open '%s' for writing", fileName);
+		return;
+	}
+	const uint32_t head = __atomic_load_n(&_samplesHead, __ATOMIC_ACQUIRE);
+	const uint32_t first = (head > (uint32_t)kSamplesCount) ? head - kSamplesCount : 0;
+	if (_output == kProfOutput_TRACE) {
+		writeString(fp, "{\"traceEvents\":[\n");
+		for (uint32_t i = first; i < head; ++i) {
+			const ProfileSample *s = &_samples[i & (kSamplesCount - 1)];
+			writeString(fp, "%s{\"name\":\"%s\",\"ph\":\"X\",\"pid\":1,\"tid\":1,\"ts\":%.3f,\"dur\":%.3f,\"args\":{\"tick\":%u}}\n",
+				(i == first) ? "" : ",", _phaseNames[s->phase], (s->startNs - _originNs) / 1000., s->durationNs / 1000., s->tick);
+		}
+		const uint32_t glFirst = (_glFramesHead > (uint32_t)kGLFramesCount) ? _glFramesHead - kGLFramesCount : 0;
+		for (uint32_t i = glFirst; i < _glFramesHead; ++i) {
+			const ProfileGLFrame *f = &_glFrames[i & (kGLFramesCount - 1)];
+			const double ts = (f->endNs - _originNs) / 1000.;
+			writeString(fp, "%s{\"name\":\"gl calls\",\"ph\":\"C\",\"pid\":1,\"ts\":%.3f,\"args\":{", (head == first && i == glFirst) ? "" : ",", ts);
+			for (int j = 0; j < kProfGLCountersCount; ++j) {
+				if (j != kProfGL_uploadBytes) {
+					writeString(fp, "%s\"%s\":%u", (j == 0) ? "" : ",", _glCounterNames[j], f->counters[j]);
+				}
+			}
+			writeString(fp, "}}\n");
+			writeString(fp, ",{\"name\":\"gl upload\",\"ph\":\"C\",\"pid\":1,\"ts\":%.3f,\"args\":{\"bytes\":%u}}\n", ts, f->counters[kProfGL_uploadBytes]);
+		}
+		writeString(fp, "],\"displayTimeUnit\":\"ms\"}\n");
+	} else {
+		writeString(fp, "tick,phase,start_us,duration_us\n");
+		for (uint32_t i = first; i < head; ++i) {
+			const ProfileSample *s = &_samples[i & (kSamplesCount - 1)];
+			writeString(fp, "%u,%s,%.3f,%.3f\n", s->tick, _phaseNames[s->phase], (s->startNs - _originNs) / 1000., s->durationNs / 1000.);
+		}
+	}
+	fileClose(fp);
+	debug(kDebug_INFO, "Wrote %d profile samples to '%s'", head - first, fileName);
+	if (_output == kProfOutput_CSV && _glFramesHead != 0) {
+		dumpGLFrames("f2bgl-profile-gl.csv");
+	}
+	_output = -1;
+}
+
+#endif // F2B_PROFILE
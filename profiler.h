@@ -0,0 +1,107 @@
+/*
+ * Fade To Black engine rewrite
+ * Copyright (C) 2006-2012 Gregory Montoir (cyx@users.sourceforge.net)
+ */
+
+#ifndef PROFILER_H__
+#define PROFILER_H__
+
+#include "util.h"
+
+enum {
+	kProfPhase_doTick = 0,
+	kProfPhase_updateSceneAnimations,
+	kProfPhase_updateSceneTextures,
+	kProfPhase_updatePlayerObject,
+	kProfPhase_redrawScene,
+	kProfPhase_updateChangedObjects,
+	kProfPhase_addObjectsToScene,
+	kProfPhase_runObject,
+	kProfPhase_updateCollidingObjects,
+	kProfPhase_drawInfoPanel,
+	kProfPhase_flushTexJobList,
+	kProfPhase_cullSceneCells,
+	kProfPhasesCount
+};
+
+enum {
+	kProfCounter_opcode = 0,
+	kProfCounter_script,
+	kProfCounter_object,
+	kProfCountersCount
+};
+
+enum {
+	kProfGL_bindTexture = 0,
+	kProfGL_bindTextureRedundant, // same texture as the one already bound
+	kProfGL_texImage,
+	kProfGL_texSubImage,
+	kProfGL_bufferData,           // glBufferData, glBufferSubData
+	kProfGL_uploadBytes,
+	kProfGL_drawArrays,
+	kProfGL_drawElements,
+	kProfGL_pointer,              // vertex, texcoord and color arrays
+	kProfGL_state,                // glEnable, glDisable and the client or attribute arrays
+	kProfGL_useProgram,
+	kProfGL_bindBuffer,
+	kProfGL_matrix,
+	kProfGL_getFloatv,
+	kProfGL_readPixels,
+	kProfGLCountersCount
+};
+
+enum {
+	kProfOutput_CSV = 0,
+	kProfOutput_TRACE // Chrome trace_event JSON, load in chrome://tracing
+};
+
+#ifdef F2B_PROFILE
+
+struct ProfileScope {
+	int _phase;
+	uint64_t _startNs;
+
+	ProfileScope(int phase);
+	~ProfileScope();
+};
+
+// accumulates invocations and time of a script opcode, CMD script or object
+struct ProfileCounterScope {
+	int _counter;
+	uint32_t _key;
+	const char *_name;
+	uint64_t _startNs;
+
+	ProfileCounterScope(int counter, uint32_t key, const char *name = 0);
+	~ProfileCounterScope();
+};
+
+void Profiler_init(int output);
+void Profiler_setTick(uint32_t tick);
+void Profiler_dump();
+
+void Profiler_enableScripts();
+void Profiler_setOpcodeNames(const char *const *names, int count);
+void Profiler_setScriptsLevel(int level);
+void Profiler_printScriptsReport();
+
+void Profiler_countGL(int counter, int uploadBytes = 0);
+void Profiler_countGLBindTexture(unsigned int texture);
+void Profiler_endFrameGL();
+void Profiler_printGLReport();
+
+#define PROFILE_SCOPE(phase) ProfileScope profileScope(phase)
+#define PROFILE_TICK(tick)   Profiler_setTick(tick)
+#define PROFILE_COUNTER(counter, key, name) ProfileCounterScope profileCounter(counter, key, name)
+#define PROFILE_GL_FRAME() Profiler_endFrameGL()
+
+#else
+
+#define PROFILE_SCOPE(phase)
+#define PROFILE_TICK(tick)
+#define PROFILE_COUNTER(counter, key, name)
+#define PROFILE_GL_FRAME()
+
+#endif // F2B_PROFILE
+
+#endif // PROFILER_H__
@@ -0,0 +1,249 @@
+/*
+ * Fade To Black engine rewrite
+ * Copyright (C) 2006-2012 Gregory Montoir (cyx@users.sourceforge.net)
+ */
+
+#include <math.h>
+#include "game.h"
+
+//
+// Potentially visible cells of the fixed cameras. The cells are walked in
+// rings of increasing distance from the eye, a ray leaving the eye cell
+// always crosses the rings in order. The angles hidden by the solid blocks
+// (cell type 1) of a ring are only used for the next rings, so a cell is
+// never culled because of a block at the same distance.
+//
+// The eye is not at the camera position : setupProjection() translates the
+// scene by 24 units along the view axis after a 20 degrees pitch, the eye is
+// on a circle around the camera position depending on the orientation. The
+// circle is sampled and the resulting set is grown by one cell.
+//
+
+static const int kEyeSamplesCount = 16;
+static const float kEyeDistance = 22.55f; // 24 * cos(20)
+
+static const int kCellSize = 16;
+static const int kMaxIntervals = kMapSizeX * kMapSizeZ * 2;
+
+struct PvsInterval {
+	float a, b;
+};
+
+// angles as a monotonic function of atan2 in the [0,4] range, cheaper to compute
+static float getPseudoAngle(float x, float z) {
+	if (z >= 0) {
+		return (x >= 0) ? z / (x + z) : 1 + x / (x - z);
+	} else {
+		return (x < 0) ? 2 + z / (x + z) : 3 + x / (x - z);
+	}
+}
+
+// disjoint closed intervals, sorted
+static PvsInterval _blocked[kMaxIntervals];
+static int _blockedCount;
+
+static bool isBlocked(float a, float b) {
+	for (int i = 0; i < _blockedCount && _blocked[i].a <= a; ++i) {
+		if (_blocked[i].b >= b) {
+			return true;
+		}
+	}
+	return false;
+}
+
+static void addBlocked(float a, float b) {
+	int i = 0;
+	while (i < _blockedCount && _blocked[i].b < a) {
+		++i;
+	}
+	int j = i;
+	while (j < _blockedCount && _blocked[j].a <= b) {
+		a = MIN(a, _blocked[j].a);
+		b = MAX(b, _blocked[j].b);
+		++j;
+	}
+	if (j == i) {
+		assert(_blockedCount < kMaxIntervals);
+		memmove(&_blocked[i + 1], &_blocked[i], (_blockedCount - i) * sizeof(PvsInterval));
+		++_blockedCount;
+	} else if (j > i + 1) {
+		memmove(&_blocked[i + 1], &_blocked[j], (_blockedCount - j) * sizeof(PvsInterval));
+		_blockedCount -= j - i - 1;
+	}
+	_blocked[i].a = a;
+	_blocked[i].b = b;
+}
+
+// the cell does not contain the eye, its angular extent is less than half
+// a turn and is split in two if it crosses the 0 angle
+static int getCellIntervals(float ex, float ez, int x, int z, PvsInterval *intervals) {
+	float angles[4];
+	angles[0] = getPseudoAngle(x * kCellSize - ex, z * kCellSize - ez);
+	angles[1] = getPseudoAngle((x + 1) * kCellSize - ex, z * kCellSize - ez);
+	angles[2] = getPseudoAngle((x + 1) * kCellSize - ex, (z + 1) * kCellSize - ez);
+	angles[3] = getPseudoAngle(x * kCellSize - ex, (z + 1) * kCellSize - ez);
+	float a = angles[0], b = angles[0];
+	for (int i = 1; i < 4; ++i) {
+		a = MIN(a, angles[i]);
+		b = MAX(b, angles[i]);
+	}
+	if (b - a <= 2) {
+		intervals[0].a = a;
+		intervals[0].b = b;
+		return 1;
+	}
+	a = 4;
+	b = 0;
+	for (int i = 0; i < 4; ++i) {
+		if (angles[i] < 2) {
+			b = MAX(b, angles[i]);
+		} else {
+			a = MIN(a, angles[i]);
+		}
+	}
+	intervals[0].a = 0;
+	intervals[0].b = b;
+	intervals[1].a = a;
+	intervals[1].b = 4;
+	return 2;
+}
+
+static bool isOccluder(const CellMap *cell, int texturesCount) {
+	if (cell->type != 1) {
+		return false;
+	}
+	const int16_t walls[] = { cell->north, cell->south, cell->west, cell->east };
+	for (int i = 0; i < 4; ++i) {
+		const int texture = walls[i] & 4095;
+		if (texture < 2 || texture >= texturesCount) {
+			return false;
+		}
+	}
+	return true;
+}
+
+void Game::castScenePvs(float ex, float ez, uint8_t visible[kMapSizeX][kMapSizeZ]) {
+	const int cx = (int)floorf(ex / kCellSize);
+	const int cz = (int)floorf(ez / kCellSize);
+	const int ringsCount = MAX(MAX(cx, kMapSizeX - 1 - cx), MAX(cz, kMapSizeZ - 1 - cz));
+	_blockedCount = 0;
+	PvsInterval occluders[4 * kMapSizeX * 2]; // a ring crosses at most 4 rows of the map
+	for (int k = 0; k <= ringsCount; ++k) {
+		int occludersCount = 0;
+		const int cellsCount = (k == 0) ? 1 : 8 * k;
+		for (int i = 0; i < cellsCount; ++i) {
+			// walk the ring edges
+			int x, z;
+			if (k == 0) {
+				x = cx;
+				z = cz;
+			} else if (i < 2 * k) {
+				x = cx - k + i;
+				z = cz - k;
+			} else if (i < 4 * k) {
+				x = cx + k;
+				z = cz - k + (i - 2 * k);
+			} else if (i < 6 * k) {
+				x = cx + k - (i - 4 * k);
+				z = cz + k;
+			} else {
+				x = cx - k;
+				z = cz + k - (i - 6 * k);
+			}
+			if (x < 0 || x >= kMapSizeX || z < 0 || z >= kMapSizeZ) {
+				continue;
+			}
+			if (k == 0) {
+				visible[x][z] = 1;
+				continue;
+			}
+			PvsInterval intervals[2];
+			const int count = getCellIntervals(ex, ez, x, z, intervals);
+			for (int j = 0; j < count; ++j) {
+				if (!isBlocked(intervals[j].a, intervals[j].b)) {
+					visible[x][z] = 1;
+					break;
+				}
+			}
+			if (isOccluder(&_sceneCellMap[x][z], _sceneAnimationsCount)) {
+				for (int j = 0; j < count; ++j) {
+					occluders[occludersCount++] = intervals[j];
+				}
+			}
+		}
+		for (int i = 0; i < occludersCount; ++i) {
+			addBlocked(occluders[i].a, occluders[i].b);
+		}
+		if (_blockedCount == 1 && _blocked[0].a <= 0 && _blocked[0].b >= 4) {
+			break;
+		}
+	}
+}
+
+void Game::computeScenePvs(int camera) {
+	ScenePvs *pvs = &_scenePvsTable[camera];
+	const CameraPosMap *camPos = &_sceneCameraPosTable[camera];
+	const float x = camPos->x / (float)(1 << kPosShift);
+	const float z = camPos->z / (float)(1 << kPosShift);
+	uint8_t visible[kMapSizeX][kMapSizeZ];
+	memset(visible, 0, sizeof(visible));
+	for (int i = 0; i < kEyeSamplesCount; ++i) {
+		const float a = i * 2 * M_PI / kEyeSamplesCount;
+		// keep the eye off the cells edges
+		castScenePvs(x + kEyeDistance * cos(a) + .01f, z + kEyeDistance * sin(a) + .01f, visible);
+	}
+	memFree(pvs->cells);
+	pvs->cells = ALLOC_TAGGED<uint8_t>(kMemTag_GEOMETRY, kMapSizeX * kMapSizeZ);
+	int count = 0;
+	for (int i = 0; i < kMapSizeX; ++i) {
+		for (int j = 0; j < kMapSizeZ; ++j) {
+			uint8_t *grown = &pvs->cells[i * kMapSizeZ + j];
+			*grown = 0;
+			for (int dx = MAX(i - 1, 0); dx <= MIN(i + 1, kMapSizeX - 1) && !*grown; ++dx) {
+				for (int dz = MAX(j - 1, 0); dz <= MIN(j + 1, kMapSizeZ - 1); ++dz) {
+					if (visible[dx][dz]) {
+						*grown = 1;
+						++count;
+						break;
+					}
+				}
+			}
+		}
+	}
+	pvs->cellsCount = count;
+	pvs->valid = true;
+	debug(kDebug_GAME, "Game::computeScenePvs() camera %d cells %d", camera, count);
+}
+
+void Game::initScenePvs() {
+	for (int i = 0; i < ARRAYSIZE(_scenePvsTable); ++i) {
+		ScenePvs *pvs = &_scenePvsTable[i];
+		memFree(pvs->cells);
+		memset(pvs, 0, sizeof(ScenePvs));
+	}
+	for (int i = 0; i < _sceneCamerasCount; ++i) {
+		computeScenePvs(i);
+	}
+}
+
+// a solid block was changed, the sets are computed again on use
+void Game::invalidateScenePvs() {
+	for (int i = 0; i < _sceneCamerasCount; ++i) {
+		_scenePvsTable[i].valid = false;
+	}
+}
+
+const ScenePvs *Game::getScenePvs() {
+	if (_currentCamera < 0 || _currentCamera >= _sceneCamerasCount) {
+		return 0;
+	}
+	const CameraPosMap *camPos = &_sceneCameraPosTable[_currentCamera];
+	if (_xPosObserver != camPos->x || _zPosObserver != camPos->z) {
+		return 0;
+	}
+	ScenePvs *pvs = &_scenePvsTable[_currentCamera];
+	if (!pvs->valid) {
+		computeScenePvs(_currentCamera);
+	}
+	return pvs;
+}
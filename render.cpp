@@ -6,52 +6,32 @@
 #ifdef USE_GLES
 #include <GLES/gl.h>
 #else
+#define GL_GLEXT_PROTOTYPES
 #include <SDL_opengl.h>
 #endif
 #include <math.h>
+#include <stddef.h>
+#include "glwrap.h"
 #include "render.h"
+#include "simd.h"
 #include "texturecache.h"
 
 static const bool kOverlayDisabled = false;
 static const int kOverlayBufSize = 320 * 200;
 
-struct Vertex3f {
-	GLfloat x, y, z;
-};
-
-struct Vertex4f {
-	GLfloat x, y, z, w;
-
-	void normalize() {
-		const GLfloat len = sqrt(x * x + y * y + z * z);
-		x /= len;
-		y /= len;
-		z /= len;
-		w /= len;
-	}
-};
-
-struct Matrix4f {
-	GLfloat t[16];
-
-	void identity() {
-		memset(t, 0, sizeof(t));
-		for (int i = 0; i < 3; ++i) {
-			t[i * 4 + i] = 1.;
-		}
-	}
+#define MAX_MATRICES 4
 
-	static void mul(const Matrix4f& a, const Matrix4f& b, Matrix4f &res) {
-		for (int i = 0; i < 16; ++i) {
-			const GLfloat *va = &a.t[i & 12];
-			const GLfloat *vb = &b.t[i &  3];
-			res.t[i] = va[0] * vb[0] + va[1] * vb[4] + va[2] * vb[8] + va[3] * vb[12];
-		}
-	}
-};
+#if defined(USE_GLES) || !defined(_WIN32)
+// opengl32.dll only exports the GL 1.1 entry points, the static quads are
+// drawn from client memory there
+#define USE_VBO
+#endif
 
-#define MAX_ATLASES 4
-#define MAX_JOBS 4096
+#if !defined(USE_GLES) && !defined(_WIN32)
+// GL 2.0 is checked at runtime. The indexed textures are drawn with a fragment
+// shader, '--render=GLSL' replaces the fixed-function pipeline
+#define USE_SHADERS
+#endif
 
 struct TexturedJobVertex {
 	GLfloat x, y, z;
@@ -61,8 +41,7 @@ struct TexturedJobVertex {
 		this->x = x; this->y = y; this->z = z; 
 		this->u = u; this->v = v; 
 	};
-} TexturedJobList[MAX_ATLASES][MAX_JOBS][3] = {};
-uint32_t TexturedJobCount[MAX_ATLASES] = {};
+};
 
 struct JobVertex {
 	GLfloat x, y, z;
@@ -72,15 +51,670 @@ struct JobVertex {
 		this->x = x; this->y = y; this->z = z; 
 		this->r = r; this->g = g; this->b = b; this->a = a;
 	};
-} JobList[MAX_JOBS][3] = {};
-uint32_t JobCount = 0;
+};
 
-#ifdef USE_GLES
+// the vertices queued for the batched draw calls. The buffers grow on demand
+// and are kept across frames, the queued commands are drawn when one is full.
+static const int kJobsChunkSize = 16384; // triangles
+static const int kJobsVerticesSize = kJobsChunkSize * 3; // fits 16 bits indices
+
+template <typename T, int N>
+struct JobArena {
+	T *data;
+	int count, capacity;
+
+	void release() {
+		memFree(data);
+		data = 0;
+		count = capacity = 0;
+	}
+
+	bool reserve(int n) {
+		if (n > capacity) {
+			if (n > N) {
+				return false;
+			}
+			int newCapacity = capacity ? capacity : 256;
+			while (newCapacity < n) {
+				newCapacity *= 2;
+			}
+			newCapacity = MIN(newCapacity, N);
+			T *p = (T *)memRealloc(kMemTag_RENDERJOBS, data, newCapacity * sizeof(T));
+			if (!p) {
+				warning("Unable to allocate %d render jobs", newCapacity);
+				return false;
+			}
+			data = p;
+			capacity = newCapacity;
+		}
+		return true;
+	}
+
+	// returns 'n' new elements, 0 if the chunk is full
+	T *alloc(int n) {
+		if (!reserve(count + n)) {
+			return 0;
+		}
+		T *p = data + count;
+		count += n;
+		return p;
+	}
+};
+
+//
+// The textured triangles, flat triangles and particles drawn between
+// setupTexJobList and flushTexJobList are queued as commands and sorted
+// on a 32 bits key before being drawn :
+//
+//   opaque      : 0 | state (15) | depth (16), front to back
+//   translucent : 1 | ~depth (16) | state (15), back to front
+//
+// The consecutive commands with the same state are drawn with one call.
+//
+enum {
+	kJobStateFlat = 0,
+	kJobStateAtlas, // + atlas
+	kJobStatePoints = kJobStateAtlas + kMaxAtlases
+};
+
+struct RenderCommand {
+	uint32_t key;
+	uint16_t first;
+	uint8_t count; // vertices
+	uint8_t state;
+};
+
+static JobArena<TexturedJobVertex, kJobsVerticesSize> _texturedJobs;
+static JobArena<JobVertex, kJobsVerticesSize> _flatJobs;
+static JobArena<RenderCommand, kJobsChunkSize> _commands;
+static JobArena<RenderCommand, kJobsChunkSize> _sortedCommands;
+static JobArena<GLushort, kJobsVerticesSize * 2> _jobIndices; // the textured and flat vertices
+
+static int _drawCallsCount;
+static int _trianglesCount;
+
+static void countPrimitives(GLenum mode, GLsizei count) {
+	++_drawCallsCount;
+	switch (mode) {
+	case GL_TRIANGLES:
+		_trianglesCount += count / 3;
+		break;
+	case GL_TRIANGLE_FAN:
+		_trianglesCount += count - 2;
+		break;
+	}
+}
+
+static uint32_t getCommandKey(int state, bool translucent, float depth) {
+	uint32_t d = 0;
+	if (depth > 0) {
+		d = (depth < 2047) ? (uint32_t)(depth * 32) : 0xFFFF;
+	}
+	if (translucent) {
+		return 0x80000000 | ((0xFFFF - d) << 15) | state;
+	}
+	return (state << 16) | d;
+}
+
+static void drawCommands();
+
+// returns the vertices of a new command, the queued commands are drawn first if the buffers are full
+template <typename T, int N>
+static T *queueCommand(JobArena<T, N> *jobs, int state, bool translucent, float depth, int count) {
+	if (_commands.count == kJobsChunkSize || jobs->count + count > N) {
+		drawCommands();
+	}
+	T *p = jobs->alloc(count);
+	if (p) {
+		RenderCommand *cmd = _commands.alloc(1);
+		if (!cmd) {
+			jobs->count -= count;
+			return 0;
+		}
+		cmd->key = getCommandKey(state, translucent, depth);
+		cmd->first = p - jobs->data;
+		cmd->count = count;
+		cmd->state = state;
+	}
+	return p;
+}
+
+// stable LSD radix sort, the passes where all the keys share the same byte are skipped
+static const RenderCommand *sortCommands() {
+	const int count = _commands.count;
+	if (!_sortedCommands.reserve(count)) {
+		return _commands.data;
+	}
+	int histogram[4][256];
+	memset(histogram, 0, sizeof(histogram));
+	for (int i = 0; i < count; ++i) {
+		const uint32_t key = _commands.data[i].key;
+		++histogram[0][key & 255];
+		++histogram[1][(key >> 8) & 255];
+		++histogram[2][(key >> 16) & 255];
+		++histogram[3][key >> 24];
+	}
+	RenderCommand *src = _commands.data;
+	RenderCommand *dst = _sortedCommands.data;
+	for (int pass = 0; pass < 4; ++pass) {
+		const int shift = pass * 8;
+		int *h = histogram[pass];
+		if (h[(src[0].key >> shift) & 255] == count) {
+			continue;
+		}
+		int offset = 0;
+		for (int i = 0; i < 256; ++i) {
+			const int n = h[i];
+			h[i] = offset;
+			offset += n;
+		}
+		for (int i = 0; i < count; ++i) {
+			dst[h[(src[i].key >> shift) & 255]++] = src[i];
+		}
+		SWAP(src, dst);
+	}
+	return src;
+}
+
+static TextureCache _textureCache;
+
+#ifdef USE_SHADERS
+// the atlas texels are palette indexes, the palette is bound to the second texture unit
+static const char *kPaletteFragmentShader =
+	"uniform sampler2D atlas;\n"
+	"uniform sampler2D palette;\n"
+	"void main() {\n"
+	"	float index = texture2D(atlas, gl_TexCoord[0].st).r;\n"
+	"	gl_FragColor = texture2D(palette, vec2((index * 255.0 + 0.5) / 256.0, 0.5)) * gl_Color;\n"
+	"}\n";
+
+static const char *kFlatVertexShader =
+	"uniform mat4 u_mvp;\n"
+	"uniform vec4 u_color;\n"
+	"uniform float u_pointSize;\n"
+	"attribute vec4 a_position;\n"
+	"attribute vec4 a_color;\n"
+	"varying vec4 v_color;\n"
+	"void main() {\n"
+	"	v_color = a_color * u_color;\n"
+	"	gl_PointSize = u_pointSize;\n"
+	"	gl_Position = u_mvp * a_position;\n"
+	"}\n";
+
+static const char *kFlatFragmentShader =
+	"#ifdef GL_ES\n"
+	"precision mediump float;\n"
+	"#endif\n"
+	"varying vec4 v_color;\n"
+	"void main() {\n"
+	"	if (v_color.a == 0.0) {\n"
+	"		discard;\n"
+	"	}\n"
+	"	gl_FragColor = v_color;\n"
+	"}\n";
+
+static const char *kTexturedVertexShader =
+	"uniform mat4 u_mvp;\n"
+	"uniform vec4 u_color;\n"
+	"attribute vec4 a_position;\n"
+	"attribute vec2 a_texCoord;\n"
+	"varying vec2 v_texCoord;\n"
+	"varying vec4 v_color;\n"
+	"void main() {\n"
+	"	v_texCoord = a_texCoord;\n"
+	"	v_color = u_color;\n"
+	"	gl_Position = u_mvp * a_position;\n"
+	"}\n";
+
+static const char *kTexturedFragmentShader =
+	"#ifdef GL_ES\n"
+	"precision mediump float;\n"
+	"#endif\n"
+	"uniform sampler2D atlas;\n"
+	"varying vec2 v_texCoord;\n"
+	"varying vec4 v_color;\n"
+	"void main() {\n"
+	"	vec4 color = texture2D(atlas, v_texCoord) * v_color;\n"
+	"	if (color.a == 0.0) {\n"
+	"		discard;\n"
+	"	}\n"
+	"	gl_FragColor = color;\n"
+	"}\n";
+
+static const char *kIndexedFragmentShader =
+	"#ifdef GL_ES\n"
+	"precision mediump float;\n"
+	"#endif\n"
+	"uniform sampler2D atlas;\n"
+	"uniform sampler2D palette;\n"
+	"varying vec2 v_texCoord;\n"
+	"varying vec4 v_color;\n"
+	"void main() {\n"
+	"	float index = texture2D(atlas, v_texCoord).r;\n"
+	"	vec4 color = texture2D(palette, vec2((index * 255.0 + 0.5) / 256.0, 0.5)) * v_color;\n"
+	"	if (color.a == 0.0) {\n"
+	"		discard;\n"
+	"	}\n"
+	"	gl_FragColor = color;\n"
+	"}\n";
+
+enum {
+	kAttribPosition = 0,
+	kAttribTexCoord,
+	kAttribColor
+};
+
+static bool hasShaders() {
+	const char *version = (const char *)glGetString(GL_VERSION);
+	return version && atoi(version) >= 2;
+}
+
+static GLuint compileShader(GLenum type, const char *source) {
+	GLuint shader = glCreateShader(type);
+	glShaderSource(shader, 1, &source, 0);
+	glCompileShader(shader);
+	GLint status;
+	glGetShaderiv(shader, GL_COMPILE_STATUS, &status);
+	if (!status) {
+		char log[512];
+		glGetShaderInfoLog(shader, sizeof(log), 0, log);
+		warning("Unable to compile shader '%s'", log);
+		glDeleteShader(shader);
+		return 0;
+	}
+	return shader;
+}
+
+// without a vertex shader, the fixed-function pipeline transforms the vertices
+static GLuint createProgram(const char *vertexSource, const char *fragmentSource) {
+	GLuint vertexShader = 0;
+	if (vertexSource) {
+		vertexShader = compileShader(GL_VERTEX_SHADER, vertexSource);
+		if (!vertexShader) {
+			return 0;
+		}
+	}
+	GLuint fragmentShader = compileShader(GL_FRAGMENT_SHADER, fragmentSource);
+	if (!fragmentShader) {
+		glDeleteShader(vertexShader);
+		return 0;
+	}
+	GLuint program = glCreateProgram();
+	if (vertexShader) {
+		glAttachShader(program, vertexShader);
+		glBindAttribLocation(program, kAttribPosition, "a_position");
+		glBindAttribLocation(program, kAttribTexCoord, "a_texCoord");
+		glBindAttribLocation(program, kAttribColor, "a_color");
+	}
+	glAttachShader(program, fragmentShader);
+	glLinkProgram(program);
+	glDeleteShader(vertexShader);
+	glDeleteShader(fragmentShader);
+	GLint status;
+	glGetProgramiv(program, GL_LINK_STATUS, &status);
+	if (!status) {
+		char log[512];
+		glGetProgramInfoLog(program, sizeof(log), 0, log);
+		warning("Unable to link program '%s'", log);
+		glDeleteProgram(program);
+		return 0;
+	}
+	glUseProgram(program);
+	glUniform1i(glGetUniformLocation(program, "atlas"), 0);
+	glUniform1i(glGetUniformLocation(program, "palette"), 1);
+	glUseProgram(0);
+	return program;
+}
+
+static GLuint _paletteProgram;
+
+//
+// With '--render=GLSL', the fixed-function state is emulated with shaders :
+//
+//   glVertexPointer, glTexCoordPointer, glColorPointer : attributes 0, 1 and 2
+//   matrices, glColor4f, glPointSize                   : uniforms
+//   GL_ALPHA_TEST (GL_NOTEQUAL 0)                      : discard
+//
+// The uniforms are uploaded when a draw call uses the program. The job lists
+// are copied to vertex buffers before the commands are drawn.
+//
+enum {
+	kProgramFlat = 0,
+	kProgramTextured,
+	kProgramIndexed,
+	kProgramsCount
+};
+
+struct ShaderProgram {
+	GLuint id;
+	GLint mvpLoc, colorLoc, pointSizeLoc;
+	int mvpSerial; // of the matrices last uploaded
+	GLfloat color[4];
+	GLfloat pointSize;
+};
+
+static struct {
+	bool enabled;
+	bool textured;
+	ShaderProgram programs[kProgramsCount];
+	const ShaderProgram *current;
+	Matrix4f projection, modelView;
+	int mvpSerial;
+	GLfloat color[4];
+	GLfloat pointSize;
+	GLuint texturedJobsVbo, flatJobsVbo, indicesVbo;
+} _glsl;
+
+static bool createShaderPipeline() {
+	if (!hasShaders()) {
+		warning("The GLSL backend requires OpenGL 2.0");
+		return false;
+	}
+	static const struct {
+		const char *vertexSource;
+		const char *fragmentSource;
+	} sources[] = {
+		{ kFlatVertexShader, kFlatFragmentShader },
+		{ kTexturedVertexShader, kTexturedFragmentShader },
+		{ kTexturedVertexShader, kIndexedFragmentShader }
+	};
+	for (int i = 0; i < kProgramsCount; ++i) {
+		ShaderProgram *p = &_glsl.programs[i];
+		p->id = createProgram(sources[i].vertexSource, sources[i].fragmentSource);
+		if (!p->id) {
+			return false;
+		}
+		p->mvpLoc = glGetUniformLocation(p->id, "u_mvp");
+		p->colorLoc = glGetUniformLocation(p->id, "u_color");
+		p->pointSizeLoc = glGetUniformLocation(p->id, "u_pointSize");
+		p->mvpSerial = -1;
+		p->color[0] = p->color[1] = p->color[2] = p->color[3] = -1.;
+		p->pointSize = -1.;
+	}
+	_glsl.textured = false;
+	_glsl.current = 0;
+	_glsl.projection.identity();
+	_glsl.modelView.identity();
+	_glsl.mvpSerial = 0;
+	_glsl.color[0] = _glsl.color[1] = _glsl.color[2] = _glsl.color[3] = 1.;
+	_glsl.pointSize = 1.;
+	glGenBuffers(1, &_glsl.texturedJobsVbo);
+	glGenBuffers(1, &_glsl.flatJobsVbo);
+	glGenBuffers(1, &_glsl.indicesVbo);
+	glVertexAttrib4f(kAttribColor, 1., 1., 1., 1.);
+	return true;
+}
+
+static void destroyShaderPipeline() {
+	for (int i = 0; i < kProgramsCount; ++i) {
+		if (_glsl.programs[i].id) {
+			glDeleteProgram(_glsl.programs[i].id);
+			_glsl.programs[i].id = 0;
+		}
+	}
+	if (_glsl.enabled) {
+		glDeleteBuffers(1, &_glsl.texturedJobsVbo);
+		glDeleteBuffers(1, &_glsl.flatJobsVbo);
+		glDeleteBuffers(1, &_glsl.indicesVbo);
+		_glsl.enabled = false;
+	}
+}
+
+// selects the program for the next draw call and updates its uniforms
+static void useShaderProgram() {
+	int num = kProgramFlat;
+	if (_glsl.textured) {
+		num = _textureCache._indexed ? kProgramIndexed : kProgramTextured;
+	}
+	ShaderProgram *p = &_glsl.programs[num];
+	if (_glsl.current != p) {
+		glUseProgram(p->id);
+		_glsl.current = p;
+	}
+	if (p->mvpSerial != _glsl.mvpSerial) {
+		Matrix4f mvp;
+		Matrix4f::mul(_glsl.modelView, _glsl.projection, mvp);
+		glUniformMatrix4fv(p->mvpLoc, 1, GL_FALSE, mvp.t);
+		p->mvpSerial = _glsl.mvpSerial;
+	}
+	if (memcmp(p->color, _glsl.color, sizeof(_glsl.color)) != 0) {
+		glUniform4fv(p->colorLoc, 1, _glsl.color);
+		memcpy(p->color, _glsl.color, sizeof(_glsl.color));
+	}
+	if (p->pointSizeLoc != -1 && p->pointSize != _glsl.pointSize) {
+		glUniform1f(p->pointSizeLoc, _glsl.pointSize);
+		p->pointSize = _glsl.pointSize;
+	}
+}
+
+// returns the offset of 'data' to pass to the attribute pointers
+static const uint8_t *uploadJobs(GLenum target, GLuint vbo, const void *data, int size) {
+	glBindBuffer(target, vbo);
+	glBufferData(target, size, data, GL_STREAM_DRAW);
+	return 0;
+}
+#endif
+
+static void setVertexPointer(int size, GLsizei stride, const void *pointer) {
+#ifdef USE_SHADERS
+	if (_glsl.enabled) {
+		glVertexAttribPointer(kAttribPosition, size, GL_FLOAT, GL_FALSE, stride, pointer);
+		return;
+	}
+#endif
+	glVertexPointer(size, GL_FLOAT, stride, pointer);
+}
+
+static void setTexCoordPointer(GLsizei stride, const void *pointer) {
+#ifdef USE_SHADERS
+	if (_glsl.enabled) {
+		glVertexAttribPointer(kAttribTexCoord, 2, GL_FLOAT, GL_FALSE, stride, pointer);
+		return;
+	}
+#endif
+	glTexCoordPointer(2, GL_FLOAT, stride, pointer);
+}
+
+static void enableColorArray(GLsizei stride, const void *pointer) {
+#ifdef USE_SHADERS
+	if (_glsl.enabled) {
+		glEnableVertexAttribArray(kAttribColor);
+		glVertexAttribPointer(kAttribColor, 4, GL_FLOAT, GL_FALSE, stride, pointer);
+		return;
+	}
+#endif
+	glEnableClientState(GL_COLOR_ARRAY);
+	glColorPointer(4, GL_FLOAT, stride, pointer);
+}
+
+static void disableColorArray() {
+#ifdef USE_SHADERS
+	if (_glsl.enabled) {
+		glDisableVertexAttribArray(kAttribColor);
+		// the current value is undefined after a draw with the array enabled
+		glVertexAttrib4f(kAttribColor, 1., 1., 1., 1.);
+		return;
+	}
+#endif
+	glDisableClientState(GL_COLOR_ARRAY);
+}
+
+static void setColor(GLfloat r, GLfloat g, GLfloat b, GLfloat a) {
+#ifdef USE_SHADERS
+	if (_glsl.enabled) {
+		_glsl.color[0] = r;
+		_glsl.color[1] = g;
+		_glsl.color[2] = b;
+		_glsl.color[3] = a;
+		return;
+	}
+#endif
+	glColor4f(r, g, b, a);
+}
 
-#define glOrtho glOrthof
-#define glFrustum glFrustumf
+static void setPointSize(GLfloat size) {
+#ifdef USE_SHADERS
+	if (_glsl.enabled) {
+		_glsl.pointSize = size;
+		return;
+	}
+#endif
+	glPointSize(size);
+}
+
+// GL is left in the GL_MODELVIEW mode
+static void loadProjectionMatrix(const Matrix4f &m) {
+#ifdef USE_SHADERS
+	if (_glsl.enabled) {
+		_glsl.projection = m;
+		++_glsl.mvpSerial;
+		return;
+	}
+#endif
+	glMatrixMode(GL_PROJECTION);
+	glLoadMatrixf(m.t);
+	glMatrixMode(GL_MODELVIEW);
+}
 
+static void loadModelViewMatrix(const Matrix4f &m) {
+#ifdef USE_SHADERS
+	if (_glsl.enabled) {
+		_glsl.modelView = m;
+		++_glsl.mvpSerial;
+		return;
+	}
 #endif
+	glLoadMatrixf(m.t);
+}
+
+static void beginTexturedDraw(GLuint tex) {
+#ifdef USE_SHADERS
+	if (_glsl.enabled) {
+		glBindTexture(GL_TEXTURE_2D, tex);
+		glEnableVertexAttribArray(kAttribTexCoord);
+		_glsl.textured = true;
+		return;
+	}
+#endif
+	glEnable(GL_TEXTURE_2D);
+	glBindTexture(GL_TEXTURE_2D, tex);
+#ifdef USE_SHADERS
+	if (_textureCache._indexed) {
+		glUseProgram(_paletteProgram);
+	}
+#endif
+}
+
+static void endTexturedDraw() {
+#ifdef USE_SHADERS
+	if (_glsl.enabled) {
+		glDisableVertexAttribArray(kAttribTexCoord);
+		_glsl.textured = false;
+		return;
+	}
+	if (_textureCache._indexed) {
+		glUseProgram(0);
+	}
+#endif
+	glDisable(GL_TEXTURE_2D);
+}
+
+static void drawArrays(GLenum mode, GLint first, GLsizei count) {
+#ifdef USE_SHADERS
+	if (_glsl.enabled) {
+		useShaderProgram();
+	}
+#endif
+	glDrawArrays(mode, first, count);
+	countPrimitives(mode, count);
+}
+
+static void drawElements(GLenum mode, GLsizei count, const GLushort *indices) {
+#ifdef USE_SHADERS
+	if (_glsl.enabled) {
+		useShaderProgram();
+	}
+#endif
+	glDrawElements(mode, count, GL_UNSIGNED_SHORT, indices);
+	countPrimitives(mode, count);
+}
+
+static void drawCommands() {
+	if (_commands.count == 0) {
+		return;
+	}
+	const RenderCommand *cmd = sortCommands();
+	int count = _commands.count;
+	// the indices of all the commands, in the drawing order
+	_jobIndices.count = 0;
+	for (int i = 0; i < count; ++i) {
+		GLushort *indices = _jobIndices.alloc(cmd[i].count);
+		if (!indices) {
+			warning("Unable to draw %d render commands", count - i);
+			count = i;
+			break;
+		}
+		for (int j = 0; j < cmd[i].count; ++j) {
+			indices[j] = cmd[i].first + j;
+		}
+	}
+	const uint8_t *texturedJobs = (const uint8_t *)_texturedJobs.data;
+	const uint8_t *flatJobs = (const uint8_t *)_flatJobs.data;
+	const GLushort *indices = _jobIndices.data;
+#ifdef USE_SHADERS
+	if (_glsl.enabled) {
+		texturedJobs = uploadJobs(GL_ARRAY_BUFFER, _glsl.texturedJobsVbo, _texturedJobs.data, _texturedJobs.count * sizeof(TexturedJobVertex));
+		flatJobs = uploadJobs(GL_ARRAY_BUFFER, _glsl.flatJobsVbo, _flatJobs.data, _flatJobs.count * sizeof(JobVertex));
+		indices = (const GLushort *)uploadJobs(GL_ELEMENT_ARRAY_BUFFER, _glsl.indicesVbo, _jobIndices.data, _jobIndices.count * sizeof(GLushort));
+	}
+#endif
+	for (int i = 0; i < count; ) {
+		const int state = cmd[i].state;
+		int indicesCount = 0;
+		for (; i < count && cmd[i].state == state; ++i) {
+			indicesCount += cmd[i].count;
+		}
+		if (state == kJobStateFlat || state == kJobStatePoints) {
+#ifdef USE_SHADERS
+			if (_glsl.enabled) {
+				glBindBuffer(GL_ARRAY_BUFFER, _glsl.flatJobsVbo);
+			}
+#endif
+			setVertexPointer(3, sizeof(JobVertex), flatJobs + offsetof(JobVertex, x));
+			enableColorArray(sizeof(JobVertex), flatJobs + offsetof(JobVertex, r));
+			if (state == kJobStatePoints) {
+				setPointSize(1.5);
+				drawElements(GL_POINTS, indicesCount, indices);
+				setPointSize(1.);
+			} else {
+				drawElements(GL_TRIANGLES, indicesCount, indices);
+			}
+			disableColorArray();
+			setColor(1., 1., 1., 1.);
+		} else {
+#ifdef USE_SHADERS
+			if (_glsl.enabled) {
+				glBindBuffer(GL_ARRAY_BUFFER, _glsl.texturedJobsVbo);
+			}
+#endif
+			beginTexturedDraw(_textureCache.getAtlasTexture(state - kJobStateAtlas));
+			setVertexPointer(3, sizeof(TexturedJobVertex), texturedJobs + offsetof(TexturedJobVertex, x));
+			setTexCoordPointer(sizeof(TexturedJobVertex), texturedJobs + offsetof(TexturedJobVertex, u));
+			drawElements(GL_TRIANGLES, indicesCount, indices);
+			endTexturedDraw();
+		}
+		indices += indicesCount;
+	}
+#ifdef USE_SHADERS
+	if (_glsl.enabled) {
+		glBindBuffer(GL_ARRAY_BUFFER, 0);
+		glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
+	}
+#endif
+	_commands.count = 0;
+	_texturedJobs.count = 0;
+	_flatJobs.count = 0;
+}
 
 static const int kVerticesBufferSize = 1024;
 static GLfloat _verticesBuffer[kVerticesBufferSize * 3];
@@ -97,47 +731,259 @@ static GLfloat *bufferVertex(const Vertex *vertices, int count) {
 	return _verticesBuffer;
 }
 
+// positions of the vertices appended to the job lists, 4 floats each
+static GLfloat _jobPositions[kVerticesBufferSize * 4];
+
+// the w coordinate is not used
+static void transformVertices(const Matrix4f &m, const Vertex *vertices, int count, GLfloat *pos) {
+#if defined(F2B_SSE2)
+	const __m128 c0 = _mm_loadu_ps(&m.t[0]);
+	const __m128 c1 = _mm_loadu_ps(&m.t[4]);
+	const __m128 c2 = _mm_loadu_ps(&m.t[8]);
+	const __m128 c3 = _mm_loadu_ps(&m.t[12]);
+	for (int i = 0; i < count; ++i) {
+		const __m128 x = _mm_set1_ps(vertices[i].x);
+		const __m128 y = _mm_set1_ps(vertices[i].y);
+		const __m128 z = _mm_set1_ps(vertices[i].z);
+		_mm_storeu_ps(pos + i * 4, _mm_add_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(c0, x), _mm_mul_ps(c1, y)), _mm_mul_ps(c2, z)), c3));
+	}
+#elif defined(F2B_NEON)
+	const float32x4_t c0 = vld1q_f32(&m.t[0]);
+	const float32x4_t c1 = vld1q_f32(&m.t[4]);
+	const float32x4_t c2 = vld1q_f32(&m.t[8]);
+	const float32x4_t c3 = vld1q_f32(&m.t[12]);
+	for (int i = 0; i < count; ++i) {
+		const float32x4_t x = vdupq_n_f32(vertices[i].x);
+		const float32x4_t y = vdupq_n_f32(vertices[i].y);
+		const float32x4_t z = vdupq_n_f32(vertices[i].z);
+		vst1q_f32(pos + i * 4, vaddq_f32(vaddq_f32(vaddq_f32(vmulq_f32(c0, x), vmulq_f32(c1, y)), vmulq_f32(c2, z)), c3));
+	}
+#else
+	for (int i = 0; i < count; ++i) {
+		for (int j = 0; j < 4; ++j) {
+			pos[i * 4 + j] = m.t[j] * vertices[i].x + m.t[4 + j] * vertices[i].y + m.t[8 + j] * vertices[i].z + m.t[12 + j];
+		}
+	}
+#endif
+}
+
 static void emitQuad2i(int x, int y, int w, int h) {
 	GLfloat vertices[] = { x, y, x + w, y, x + w, y + h, x, y + h };
-	glVertexPointer(2, GL_FLOAT, 0, vertices);
-	glDrawArrays(GL_TRIANGLE_FAN, 0, 4);
+	setVertexPointer(2, 0, vertices);
+	drawArrays(GL_TRIANGLE_FAN, 0, 4);
 }
 
 static void emitQuadTex2i(int x, int y, int w, int h, GLfloat *uv) {	
 	GLfloat vertices[] = { x, y, x + w, y, x + w, y + h, x, y + h };
-	glVertexPointer(2, GL_FLOAT, 0, vertices);
-	glTexCoordPointer(2, GL_FLOAT, 0, uv);
-	glDrawArrays(GL_TRIANGLE_FAN, 0, 4);
+	setVertexPointer(2, 0, vertices);
+	setTexCoordPointer(0, uv);
+	drawArrays(GL_TRIANGLE_FAN, 0, 4);
+}
+
+static void emitQuadTex3i(const Vertex *vertices, GLfloat *uv) {
+	setVertexPointer(3, 0, bufferVertex(vertices, 4));
+	setTexCoordPointer(0, uv);
+	drawArrays(GL_TRIANGLE_FAN, 0, 4);
+}
+
+static void emitTriTex3i(const Vertex *vertices, const GLfloat *uv) {
+	setVertexPointer(3, 0, bufferVertex(vertices, 3));
+	setTexCoordPointer(0, uv);
+	drawArrays(GL_TRIANGLES, 0, 3);
+}
+
+static void emitTriFan3i(const Vertex *vertices, int count) {
+	setVertexPointer(3, 0, bufferVertex(vertices, count));
+	drawArrays(GL_TRIANGLE_FAN, 0, 4);
+}
+
+struct RenderGL : Render {
+	uint8_t _clut[256 * 3];
+	float _pixelColorMap[4][256];
+	uint8_t *_screenshotBuf;
+	struct {
+		uint8_t *buf;
+		Texture *tex;
+		bool hflip;
+		int r, g, b;
+		int drawnY0, drawnY1; // rows written since the last upload
+		int clearedY0, clearedY1; // rows cleared after the last upload
+	} _overlay;
+
+	struct StaticQuad {
+		GLfloat vertices[4 * 3];
+		GLfloat uv[4 * 2];
+		Texture *tex;
+		int primitive;
+		int atlas;  // -1 if hidden
+		int offset; // in _static.vertices, grouped by atlas
+	};
+	struct {
+		StaticQuad *quads;
+		int count;
+		TexturedJobVertex *vertices; // two triangles per visible quad
+		int atlasOffset[kMaxAtlases];
+		int atlasCount[kMaxAtlases];
+		GLuint vbo;
+		bool layoutChanged; // a quad was shown, hidden or moved to another atlas
+		int dirtyFirst, dirtyLast;
+	} _static;
+
+	// the matrices are built on the CPU and loaded with glLoadMatrixf (or as
+	// the u_mvp uniform with GLSL), the
+	// fixed-function stack is never read back
+	struct {
+		Matrix4f projection;
+		Matrix4f modelView[MAX_MATRICES];
+		int modelViewTop;
+	} _matrix;
+	struct {
+		bool active; // the polygons of the object are appended to the scene job lists
+		Matrix4f transform;
+	} _objectBatch;
+
+	uint8_t isBatching;
+
+	RenderGL(bool shaders, int atlasSize);
+	virtual ~RenderGL();
+
+	virtual void flushCachedTextures();
+	Texture *getTexture(const uint8_t *texData, int texW, int texH, int16_t texKey);
+	bool evictTextures(int w, int h);
+
+	virtual void drawPolygonFlat(const Vertex *vertices, int verticesCount, int color);
+	virtual void drawPolygonTexture(const Vertex *vertices, int verticesCount, int primitive, const uint8_t *texData, int texW, int texH, int16_t texKey);
+	void _drawPolygonFlat(const Vertex *vertices, int verticesCount, int color);
+	void _drawPolygonTexture(const Vertex *vertices, int verticesCount, int primitive, const uint8_t *texData, int texW, int texH, int16_t texKey);
+	virtual void drawParticles(const Vertex *pos, const uint8_t *colors, int count);
+	virtual void drawSprite(int x, int y, const uint8_t *texData, int texW, int texH, int16_t texKey);
+	virtual void drawRectangle(int x, int y, int w, int h, int color);
+
+	virtual void initStaticQuads(int count);
+	virtual void setStaticQuad(int num, const Vertex *vertices);
+	virtual void setStaticQuadTexture(int num, int primitive, const uint8_t *texData, int texW, int texH, int16_t texKey);
+	virtual void drawStaticQuads(const uint8_t *quadsMask);
+	const GLfloat *bufferJobPositions(const Vertex *vertices, int count);
+	void writeStaticQuad(const StaticQuad *q);
+	void updateStaticQuadsLayout();
+	void drawStaticQuadsRuns(int atlas, const uint8_t *quadsMask);
+
+	virtual void beginObjectDraw(int x, int y, int z, int ry, int shift);
+	virtual void endObjectDraw();
+
+	void loadMatrices();
+	void updateFrustrumPlanes();
+
+	virtual void setOverlayBlendColor(int r, int g, int b);
+	virtual void setOverlayDim(int w, int h, bool hflip);
+	virtual void copyToOverlay(int x, int y, const uint8_t *data, int pitch, int w, int h, int transparentColor);
+
+	virtual void setPalette(const uint8_t *pal, int count);
+	virtual void clearScreen();
+	virtual void setupProjection(int mode);
+	virtual void setupProjection2d();
+	virtual void drawOverlay();
+	virtual void resizeScreen(int w, int h);
+
+	float getViewDepth(const GLfloat *pos, int count) const;
+	virtual void setupTexJobList();
+	virtual void flushTexJobList();
+	virtual const uint8_t *captureScreen(int *w, int *h);
+};
+
+Render::Render() {
+	_w = _h = 0;
+	_viewport.changed = true;
+	_viewport.pw = 256;
+	_viewport.ph = 256;
+	_cameraPos.x = _cameraPos.y = _cameraPos.z = 0;
+	_cameraPitch = 0;
+	_batchObjects = false;
+	memset(_frustum, 0, sizeof(_frustum));
+	Frustum_setPlanes(&_frustumPlanes, _frustum);
+	memset(&_frameStats, 0, sizeof(_frameStats));
+}
+
+Render::~Render() {
+}
+
+void Render::resizeScreen(int w, int h) {
+	_w = w;
+	_h = h;
+	_viewport.changed = true;
+}
+
+void Render::setCameraPos(int x, int y, int z, int shift) {
+	const float div = 1 << shift;
+	_cameraPos.x = x / div;
+	_cameraPos.z = z / div;
+	_cameraPos.y = y / div;
+}
+
+void Render::setCameraPitch(int ry) {
+	_cameraPitch = ry * 360 / 1024.;
+}
+
+void Render::updateFrustrumPlanes(const Matrix4f &proj, const Matrix4f &modl) {
+	Matrix4f clip;
+	Matrix4f::mul(modl, proj, clip);
+	// extract right,left,top,bottom,far,near planes
+	const float *v = &clip.t[0];
+	int i = 0;
+	while (i < 6) {
+		_frustum[i].x = clip.t[3]  - v[0];
+		_frustum[i].y = clip.t[7]  - v[4];
+		_frustum[i].z = clip.t[11] - v[8];
+		_frustum[i].w = clip.t[15] - v[12];
+		_frustum[i].normalize();
+		++i;
+		_frustum[i].x = clip.t[3]  + v[0];
+		_frustum[i].y = clip.t[7]  + v[4];
+		_frustum[i].z = clip.t[11] + v[8];
+		_frustum[i].w = clip.t[15] + v[12];
+		_frustum[i].normalize();
+		++i;
+		++v;
+	}
+	Frustum_setPlanes(&_frustumPlanes, _frustum);
 }
 
-static void emitQuadTex3i(const Vertex *vertices, GLfloat *uv) {
-	glVertexPointer(3, GL_FLOAT, 0, bufferVertex(vertices, 4));
-	glTexCoordPointer(2, GL_FLOAT, 0, uv);
-	glDrawArrays(GL_TRIANGLE_FAN, 0, 4);
-}
+static const struct {
+	int backend;
+	const char *str;
+} _renderBackends[] = {
+	{ kRenderGL,     "GL"     },
+	{ kRenderGLSL,   "GLSL"   },
+	{ kRenderNull,   "NULL"   },
+	{ kRenderRecord, "RECORD" }
+};
 
-static void emitTriTex3i(const Vertex *vertices, const GLfloat *uv) {
-	glVertexPointer(3, GL_FLOAT, 0, bufferVertex(vertices, 3));
-	glTexCoordPointer(2, GL_FLOAT, 0, uv);
-	glDrawArrays(GL_TRIANGLES, 0, 3);
+int Render_parseBackend(const char *name) {
+	for (int i = 0; i < ARRAYSIZE(_renderBackends); ++i) {
+		if (strcasecmp(_renderBackends[i].str, name) == 0) {
+			return _renderBackends[i].backend;
+		}
+	}
+	return -1;
 }
 
-static void emitTriFan3i(const Vertex *vertices, int count) {
-	glVertexPointer(3, GL_FLOAT, 0, bufferVertex(vertices, count));
-	glDrawArrays(GL_TRIANGLE_FAN, 0, 4);
+Render *Render_create(int backend, int atlasSize) {
+	switch (backend) {
+	case kRenderNull:
+		return RenderNull_create(false);
+	case kRenderRecord:
+		return RenderNull_create(true);
+	case kRenderGLSL:
+		return RenderGL_create(true, atlasSize);
+	}
+	return RenderGL_create(false, atlasSize);
 }
 
-static void emitPoint3f(const Vertex *pos) {
-	glVertexPointer(3, GL_FLOAT, 0, bufferVertex(pos, 1));
-	glDrawArrays(GL_POINTS, 0, 1);
+Render *RenderGL_create(bool shaders, int atlasSize) {
+	return new RenderGL(shaders, atlasSize);
 }
 
-static TextureCache _textureCache;
-static Vertex3f _cameraPos;
-static GLfloat _cameraPitch;
-static Vertex4f _frustum[6];
-
-Render::Render() {
+RenderGL::RenderGL(bool shaders, int atlasSize) {
 	memset(_clut, 0, sizeof(_clut));
 	isBatching = 0;
 	_screenshotBuf = 0;
@@ -145,168 +991,264 @@ Render::Render() {
 	_overlay.tex = 0;
 	_overlay.hflip = false;
 	_overlay.r = _overlay.g = _overlay.b = 255;
-	_viewport.changed = true;
-	_viewport.pw = 256;
-	_viewport.ph = 256;
-	_textureCache.init();
+	_overlay.drawnY0 = _overlay.drawnY1 = 0;
+	_overlay.clearedY0 = _overlay.clearedY1 = 0;
+	memset(&_static, 0, sizeof(_static));
+	_matrix.projection.identity();
+	_matrix.modelView[0].identity();
+	_matrix.modelViewTop = 0;
+	_objectBatch.active = false;
+	bool indexed = false;
+#ifdef USE_SHADERS
+	if (shaders) {
+		_glsl.enabled = createShaderPipeline();
+		if (!_glsl.enabled) {
+			warning("Unable to create the GLSL pipeline, using the fixed-function pipeline");
+			destroyShaderPipeline();
+		}
+	}
+	if (!_glsl.enabled && hasShaders()) {
+		_paletteProgram = createProgram(0, kPaletteFragmentShader);
+	}
+	indexed = _glsl.enabled || _paletteProgram != 0;
+#else
+	if (shaders) {
+		warning("GLSL rendering is not supported by this build, using the fixed-function pipeline");
+	}
+#endif
+	_textureCache.init(indexed, atlasSize);
+#ifdef USE_SHADERS
+	if (_textureCache._indexed) {
+		glActiveTexture(GL_TEXTURE1);
+		glBindTexture(GL_TEXTURE_2D, _textureCache._paletteTex);
+		glActiveTexture(GL_TEXTURE0);
+	}
+#endif
 }
 
-Render::~Render() {
+RenderGL::~RenderGL() {
 	free(_screenshotBuf);
 	free(_overlay.buf);
+	initStaticQuads(0);
+	_texturedJobs.release();
+	_flatJobs.release();
+	_commands.release();
+	_sortedCommands.release();
+	_jobIndices.release();
+#ifdef USE_SHADERS
+	if (_paletteProgram) {
+		glDeleteProgram(_paletteProgram);
+		_paletteProgram = 0;
+	}
+	destroyShaderPipeline();
+#endif
 }
 
-void Render::flushCachedTextures() {
+void RenderGL::flushCachedTextures() {
+	// the quads unpin their textures
+	initStaticQuads(0);
 	_textureCache.flush();
 	_overlay.tex = 0;
 }
 
-void Render::resizeScreen(int w, int h) {
-	glDisable(GL_LIGHTING);
+void RenderGL::resizeScreen(int w, int h) {
 	glEnable(GL_BLEND);
 	glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
 	glEnable(GL_DEPTH_TEST);
-	glEnable(GL_ALPHA_TEST);
-	glAlphaFunc(GL_NOTEQUAL, 0.);
-	_w = w;
-	_h = h;
+#ifdef USE_SHADERS
+	if (_glsl.enabled) {
+		// the point size is written by the vertex shader
+		glEnable(GL_VERTEX_PROGRAM_POINT_SIZE);
+	} else
+#endif
+	{
+		glDisable(GL_LIGHTING);
+		glEnable(GL_ALPHA_TEST);
+		glAlphaFunc(GL_NOTEQUAL, 0.);
+	}
+	Render::resizeScreen(w, h);
 	free(_screenshotBuf);
 	_screenshotBuf = 0;
-	_viewport.changed = true;
-}
-
-void Render::setCameraPos(int x, int y, int z, int shift) {
-	const GLfloat div = 1 << shift;
-	_cameraPos.x = x / div;
-	_cameraPos.z = z / div;
-	_cameraPos.y = y / div;
-}
-
-void Render::setCameraPitch(int ry) {
-	_cameraPitch = ry * 360 / 1024.;
 }
 
-static void emitTexturedTriangles(GLuint tex, const Vertex *vertices, int verticesCount, GLfloat *uv)
+static void emitTexturedTriangles(GLuint tex, const GLfloat *pos, int verticesCount, GLfloat *uv, float depth)
 {
-	int job = TexturedJobCount[tex];
+	TexturedJobVertex *job = queueCommand(&_texturedJobs, kJobStateAtlas + tex, false, depth, (verticesCount - 2) * 3);
+	if (!job) {
+		return;
+	}
 	
 	for (int i = 2; i < verticesCount; i++)
 	{
-		TexturedJobList[tex][job][0].setJob(vertices[0  ].x, vertices[0  ].y, vertices[0  ].z, uv[0],       uv[1]);
-		TexturedJobList[tex][job][1].setJob(vertices[i-1].x, vertices[i-1].y, vertices[i-1].z, uv[2*(i-1)], uv[2*(i-1)+1]);
-		TexturedJobList[tex][job][2].setJob(vertices[i  ].x, vertices[i  ].y, vertices[i  ].z, uv[2*i],     uv[2*i+1]);
+		const GLfloat *p0 = pos;
+		const GLfloat *p1 = pos + (i - 1) * 4;
+		const GLfloat *p2 = pos + i * 4;
+		job[0].setJob(p0[0], p0[1], p0[2], uv[0],       uv[1]);
+		job[1].setJob(p1[0], p1[1], p1[2], uv[2*(i-1)], uv[2*(i-1)+1]);
+		job[2].setJob(p2[0], p2[1], p2[2], uv[2*i],     uv[2*i+1]);
 		
-		job++;
+		job += 3;
 	}
-	
-	TexturedJobCount[tex] += verticesCount - 2;
 }
 
-void Render::drawPolygonTexture(const Vertex *vertices, int verticesCount, int primitive, const uint8_t *texData, int texW, int texH, int16_t texKey) {
-	if (!isBatching) {
-		_drawPolygonTexture(vertices, verticesCount, primitive, texData, texW, texH, texKey);
-		return;
-	}
-	
-	assert(texData && texW > 0 && texH > 0);
-	assert(vertices && verticesCount >= 4);
-	
-	Texture *t = _textureCache.getCachedTexture(texData, texW, texH, texKey);
-	assert(t->id <= MAX_ATLASES);
-	if(TexturedJobCount[t->id] + (verticesCount - 2) > MAX_JOBS) {
-		warning("Cannot allocate new job");
-		return;
-	}
-	
+// texture coordinates of the polygon vertices, returns the vertices count
+static int getTexCoords(const Texture *t, int primitive, GLfloat *uv) {
+	const GLfloat mx = (t->u + t->x) / 2;
 	switch (primitive) {
 	case 0:	case 2:
 		{
-			GLfloat uv[] = { 
+			const GLfloat tmp[] = { 
 				t->x, t->y, 
 				t->u, t->y, 
 				t->u, t->v, 
 				t->x, t->v 
 			};
-
-			emitTexturedTriangles(t->id - 1, vertices, verticesCount, uv);
+			memcpy(uv, tmp, sizeof(tmp));
 		}
-		break;
+		return 4;
 	case 1:
 		{
-			GLfloat uv[] = { 
-				(t->u + t->x) / 2, t->y, 
-				t->u,              t->v, 
-				t->x,              t->v 
+			const GLfloat tmp[] = { 
+				mx,   t->y, 
+				t->u, t->v, 
+				t->x, t->v 
 			};
-			
-			emitTexturedTriangles(t->id - 1, vertices, verticesCount, uv);
+			memcpy(uv, tmp, sizeof(tmp));
 		}
-		break;
+		return 3;
 	case 3:	case 5:
 		{
-			GLfloat uv[] = { 
+			const GLfloat tmp[] = { 
 				t->u, t->y, 
 				t->u, t->v, 
 				t->x, t->v, 
 				t->x, t->y 
 			};
-			
-			emitTexturedTriangles(t->id - 1, vertices, verticesCount, uv);
+			memcpy(uv, tmp, sizeof(tmp));
 		}
-		break;
+		return 4;
 	case 4:
 		{
-			GLfloat uv[] = { 
-				t->u,              t->v, 
-				t->x,              t->v, 
-				(t->u + t->x) / 2, t->y 
+			const GLfloat tmp[] = { 
+				t->u, t->v, 
+				t->x, t->v, 
+				mx,   t->y 
 			};
-			
-			emitTexturedTriangles(t->id - 1, vertices, verticesCount, uv);
+			memcpy(uv, tmp, sizeof(tmp));
 		}
-		break;
+		return 3;
 	case 6:	case 8:
 		{
-			GLfloat uv[] = { 
+			const GLfloat tmp[] = { 
 				t->u, t->v, 
 				t->x, t->v, 
 				t->x, t->y, 
 				t->u, t->y 
 			};
-			
-			emitTexturedTriangles(t->id - 1, vertices, verticesCount, uv);
+			memcpy(uv, tmp, sizeof(tmp));
 		}
-		break;
+		return 4;
 	case 7:
 		{
-			GLfloat uv[] = { 
-				t->x,              t->v, 
-				(t->x + t->u) / 2, t->y, 
-				t->u,              t->v 
+			const GLfloat tmp[] = { 
+				t->x, t->v, 
+				mx,   t->y, 
+				t->u, t->v 
 			};
-			
-			emitTexturedTriangles(t->id - 1, vertices, verticesCount, uv);
+			memcpy(uv, tmp, sizeof(tmp));
 		}
-		break;
+		return 3;
 	case 9:	case 10:
 		{
-			GLfloat uv[] = { 
+			const GLfloat tmp[] = { 
 				t->x, t->y, 
 				t->x, t->v, 
 				t->u, t->v, 
 				t->u, t->y 
 			};
-			
-			emitTexturedTriangles(t->id - 1, vertices, verticesCount, uv);
+			memcpy(uv, tmp, sizeof(tmp));
 		}
-		break;
-	default:
-		//warning("Render::drawPolygonTexture() unhandled primitive %d", primitive);
-		break;
+		return 4;
+	}
+	//warning("Render::drawPolygonTexture() unhandled primitive %d", primitive);
+	return 0;
+}
+
+// returns 0 if the texture does not fit in the atlases
+Texture *RenderGL::getTexture(const uint8_t *texData, int texW, int texH, int16_t texKey) {
+	Texture *t = _textureCache.getCachedTexture(texData, texW, texH, texKey);
+	if (!t && evictTextures(texW, texH)) {
+		t = _textureCache.getCachedTexture(texData, texW, texH, texKey);
+	}
+	if (!t) {
+		warning("Unable to allocate a %dx%d texture", texW, texH);
+	}
+	return t;
+}
+
+bool RenderGL::evictTextures(int w, int h) {
+	// the queued commands use the texture coordinates before the eviction
+	drawCommands();
+	const bool evicted = _textureCache.evictTextures(w, h);
+	for (int i = 0; i < _static.count; ++i) {
+		StaticQuad *q = &_static.quads[i];
+		if (q->tex) {
+			q->atlas = (getTexCoords(q->tex, q->primitive, q->uv) == 4) ? q->tex->atlas : -1;
+		}
+	}
+	_static.layoutChanged = true;
+	return evicted;
+}
+
+void RenderGL::drawPolygonTexture(const Vertex *vertices, int verticesCount, int primitive, const uint8_t *texData, int texW, int texH, int16_t texKey) {
+	if (!isBatching) {
+		_drawPolygonTexture(vertices, verticesCount, primitive, texData, texW, texH, texKey);
+		return;
+	}
+	
+	assert(texData && texW > 0 && texH > 0);
+	assert(vertices && verticesCount >= 4);
+	
+	Texture *t = getTexture(texData, texW, texH, texKey);
+	if (!t) {
+		return;
 	}
+	
+	GLfloat uv[8];
+	const int count = getTexCoords(t, primitive, uv);
+	if (count) {
+		const GLfloat *pos = bufferJobPositions(vertices, count);
+		emitTexturedTriangles(t->atlas, pos, count, uv, getViewDepth(pos, count));
+	}
+}
+
+const GLfloat *RenderGL::bufferJobPositions(const Vertex *vertices, int count) {
+	assert(count <= kVerticesBufferSize);
+	if (_objectBatch.active) {
+		transformVertices(_objectBatch.transform, vertices, count, _jobPositions);
+	} else {
+		for (int i = 0; i < count; ++i) {
+			_jobPositions[i * 4]     = vertices[i].x;
+			_jobPositions[i * 4 + 1] = vertices[i].y;
+			_jobPositions[i * 4 + 2] = vertices[i].z;
+		}
+	}
+	return _jobPositions;
 }
 
-void Render::drawPolygonFlat(const Vertex *vertices, int verticesCount, int color) {
+// distance to the eye of the polygon center, in the current modelview
+float RenderGL::getViewDepth(const GLfloat *pos, int count) const {
+	const Matrix4f &m = _matrix.modelView[_matrix.modelViewTop];
+	GLfloat x = 0, y = 0, z = 0;
+	for (int i = 0; i < count; ++i) {
+		x += pos[i * 4];
+		y += pos[i * 4 + 1];
+		z += pos[i * 4 + 2];
+	}
+	return -(m.t[2] * x + m.t[6] * y + m.t[10] * z) / count - m.t[14];
+}
+
+void RenderGL::drawPolygonFlat(const Vertex *vertices, int verticesCount, int color) {
 	if (!isBatching) {
 		_drawPolygonFlat(vertices, verticesCount, color);
 		return;
@@ -345,58 +1287,67 @@ void Render::drawPolygonFlat(const Vertex *vertices, int verticesCount, int colo
 		break;
 	}
 	
+	if (verticesCount < 3) {
+		return;
+	}
+	const GLfloat *pos = bufferJobPositions(vertices, verticesCount);
+	JobVertex *job = queueCommand(&_flatJobs, kJobStateFlat, a < 1., getViewDepth(pos, verticesCount), (verticesCount - 2) * 3);
+	if (!job) {
+		return;
+	}
+	
 	for (int i = 2; i < verticesCount; i++) {
-		if (JobCount+1 > MAX_JOBS) {
-			warning("Too many scheduled jobs! Dropping jobs");
-			return;
-		}
+		const GLfloat *p0 = pos;
+		const GLfloat *p1 = pos + (i - 1) * 4;
+		const GLfloat *p2 = pos + i * 4;
+		job[0].setJob(p0[0], p0[1], p0[2], r, g, b, a);
+		job[1].setJob(p1[0], p1[1], p1[2], r, g, b, a);
+		job[2].setJob(p2[0], p2[1], p2[2], r, g, b, a);
 		
-		JobList[JobCount][0].setJob(vertices[0  ].x, vertices[0  ].y, vertices[0  ].z, r, g, b, a);
-		JobList[JobCount][1].setJob(vertices[i-1].x, vertices[i-1].y, vertices[i-1].z, r, g, b, a);
-		JobList[JobCount][2].setJob(vertices[i  ].x, vertices[i  ].y, vertices[i  ].z, r, g, b, a);
-		
-		JobCount++;
+		job += 3;
 	}
 }
 
-void Render::_drawPolygonFlat(const Vertex *vertices, int verticesCount, int color) {
+void RenderGL::_drawPolygonFlat(const Vertex *vertices, int verticesCount, int color) {
 	switch (color) {
 	case kFlatColorRed:
-		glColor4f(1., 0., 0., .5);
+		setColor(1., 0., 0., .5);
 		break;
 	case kFlatColorGreen:
-		glColor4f(0., 1., 0., .5);
+		setColor(0., 1., 0., .5);
 		break;
 	case kFlatColorYellow:
-		glColor4f(1., 1., 0., .5);
+		setColor(1., 1., 0., .5);
 		break;
 	case kFlatColorBlue:
-		glColor4f(0., 0., 1., .5);
+		setColor(0., 0., 1., .5);
 		break;
 	case kFlatColorShadow:
-		glColor4f(0., 0., 0., .5);
+		setColor(0., 0., 0., .5);
 		break;
 	case kFlatColorLight:
-		glColor4f(1., 1., 1., .2);
+		setColor(1., 1., 1., .2);
 		break;
 	default:
 		if (color >= 0 && color < 256) {
-			glColor4f(_pixelColorMap[0][color], _pixelColorMap[1][color], _pixelColorMap[2][color], _pixelColorMap[3][color]);
+			setColor(_pixelColorMap[0][color], _pixelColorMap[1][color], _pixelColorMap[2][color], _pixelColorMap[3][color]);
 		} else {
 			warning("Render::drawPolygonFlat() unhandled color %d", color);
 		}
 		break;
 	}
 	emitTriFan3i(vertices, verticesCount);
-	glColor4f(1., 1., 1., 1.);
+	setColor(1., 1., 1., 1.);
 }
 
-void Render::_drawPolygonTexture(const Vertex *vertices, int verticesCount, int primitive, const uint8_t *texData, int texW, int texH, int16_t texKey) {
+void RenderGL::_drawPolygonTexture(const Vertex *vertices, int verticesCount, int primitive, const uint8_t *texData, int texW, int texH, int16_t texKey) {
 	assert(texData && texW > 0 && texH > 0);
 	assert(vertices && verticesCount >= 4);
-	glEnable(GL_TEXTURE_2D);
-	Texture *t = _textureCache.getCachedTexture(texData, texW, texH, texKey);
-	glBindTexture(GL_TEXTURE_2D, t->id);
+	Texture *t = getTexture(texData, texW, texH, texKey);
+	if (!t) {
+		return;
+	}
+	beginTexturedDraw(t->id);
 	const GLfloat tx = t->u;
 	const GLfloat ty = t->v;
 	switch (primitive) {
@@ -485,43 +1436,78 @@ void Render::_drawPolygonTexture(const Vertex *vertices, int verticesCount, int
 		warning("Render::drawPolygonTexture() unhandled primitive %d", primitive);
 		break;
 	}
-	glDisable(GL_TEXTURE_2D);
+	endTexturedDraw();
 }
 
-void Render::drawParticle(const Vertex *pos, int color) {
-	assert(color >= 0 && color < 256);
-	glColor4f(_pixelColorMap[0][color], _pixelColorMap[1][color], _pixelColorMap[2][color], 1.);
-	glPointSize(1.5);
-	emitPoint3f(pos);
-	glPointSize(1.);
-	glColor4f(1., 1., 1., 1.);
+void RenderGL::drawParticles(const Vertex *pos, const uint8_t *colors, int count) {
+	if (isBatching) {
+		for (int i = 0; i < count; ++i) {
+			const GLfloat *p = bufferJobPositions(&pos[i], 1);
+			JobVertex *job = queueCommand(&_flatJobs, kJobStatePoints, false, getViewDepth(p, 1), 1);
+			if (job) {
+				const int color = colors[i];
+				job->setJob(p[0], p[1], p[2], _pixelColorMap[0][color], _pixelColorMap[1][color], _pixelColorMap[2][color], 1.);
+			}
+		}
+		return;
+	}
+	// the flat jobs are empty outside of the batches
+	JobVertex *job = _flatJobs.alloc(count);
+	if (!job) {
+		return;
+	}
+	for (int i = 0; i < count; ++i) {
+		const int color = colors[i];
+		job[i].setJob(pos[i].x, pos[i].y, pos[i].z, _pixelColorMap[0][color], _pixelColorMap[1][color], _pixelColorMap[2][color], 1.);
+	}
+	setVertexPointer(3, sizeof(JobVertex), &job->x);
+	enableColorArray(sizeof(JobVertex), &job->r);
+	setPointSize(1.5);
+	drawArrays(GL_POINTS, 0, count);
+	setPointSize(1.);
+	disableColorArray();
+	setColor(1., 1., 1., 1.);
+	_flatJobs.count = 0;
 }
 
-void Render::drawSprite(int x, int y, const uint8_t *texData, int texW, int texH, int16_t texKey) {
+void RenderGL::drawSprite(int x, int y, const uint8_t *texData, int texW, int texH, int16_t texKey) {
 	glDisable(GL_DEPTH_TEST);
-	glEnable(GL_TEXTURE_2D);
-	Texture *t = _textureCache.getCachedTexture(texData, texW, texH, texKey);
-	glBindTexture(GL_TEXTURE_2D, t->id);
+	Texture *t = getTexture(texData, texW, texH, texKey);
+	if (!t) {
+		glEnable(GL_DEPTH_TEST);
+		return;
+	}
+	beginTexturedDraw(t->id);
 	GLfloat uv[] = { t->x, t->y, t->u, t->y, t->u, t->v, t->x, t->v };
 	emitQuadTex2i(x, y, texW, texH, uv);
-	glDisable(GL_TEXTURE_2D);
+	endTexturedDraw();
 	glEnable(GL_DEPTH_TEST);
 }
 
-void Render::drawRectangle(int x, int y, int w, int h, int color) {
+void RenderGL::drawRectangle(int x, int y, int w, int h, int color) {
 	glDisable(GL_DEPTH_TEST);
 	assert(color >= 0 && color < 256);
-	glColor4f(_pixelColorMap[0][color], _pixelColorMap[1][color], _pixelColorMap[2][color], _pixelColorMap[3][color]);
+	setColor(_pixelColorMap[0][color], _pixelColorMap[1][color], _pixelColorMap[2][color], _pixelColorMap[3][color]);
 	emitQuad2i(x, y, w, h);
-	glColor4f(1., 1., 1., 1.);
+	setColor(1., 1., 1., 1.);
 	glEnable(GL_DEPTH_TEST);
 }
 
-void Render::copyToOverlay(int x, int y, const uint8_t *data, int pitch, int w, int h, int transparentColor) {
+void RenderGL::copyToOverlay(int x, int y, const uint8_t *data, int pitch, int w, int h, int transparentColor) {
 	if (kOverlayDisabled) return;
 	assert(_overlay.tex);
 	assert(x + w <= _overlay.tex->bitmapW);
 	assert(y + h <= _overlay.tex->bitmapH);
+	if (h <= 0) {
+		return;
+	}
+	if (_overlay.drawnY0 == _overlay.drawnY1) {
+		_overlay.drawnY0 = y;
+		_overlay.drawnY1 = y + h;
+	} else {
+		_overlay.drawnY0 = MIN(_overlay.drawnY0, y);
+		_overlay.drawnY1 = MAX(_overlay.drawnY1, y + h);
+	}
 	const int dstPitch = _overlay.tex->bitmapW;
 	uint8_t *dst = _overlay.buf + y * dstPitch + x;
 	if (transparentColor == -1) {
@@ -543,61 +1529,237 @@ void Render::copyToOverlay(int x, int y, const uint8_t *data, int pitch, int w,
 	}
 }
 
-void Render::beginObjectDraw(int x, int y, int z, int ry, int shift) {
-	glPushMatrix();
+void RenderGL::initStaticQuads(int count) {
+	for (int i = 0; i < _static.count; ++i) {
+		if (_static.quads[i].tex) {
+			--_static.quads[i].tex->pinCount;
+		}
+	}
+#ifdef USE_VBO
+	if (_static.vbo) {
+		glDeleteBuffers(1, &_static.vbo);
+	}
+#endif
+	memFree(_static.quads);
+	memFree(_static.vertices);
+	memset(&_static, 0, sizeof(_static));
+	if (count > 0) {
+		_static.quads = ALLOC_TAGGED<StaticQuad>(kMemTag_GEOMETRY, count);
+		_static.vertices = ALLOC_TAGGED<TexturedJobVertex>(kMemTag_GEOMETRY, count * 6);
+		_static.count = count;
+		for (int i = 0; i < count; ++i) {
+			_static.quads[i].tex = 0;
+			_static.quads[i].atlas = -1;
+		}
+#ifdef USE_VBO
+		glGenBuffers(1, &_static.vbo);
+#endif
+	}
+}
+
+void RenderGL::setStaticQuad(int num, const Vertex *vertices) {
+	assert(num >= 0 && num < _static.count);
+	StaticQuad *q = &_static.quads[num];
+	for (int i = 0; i < 4; ++i) {
+		q->vertices[i * 3]     = vertices[i].x;
+		q->vertices[i * 3 + 1] = vertices[i].y;
+		q->vertices[i * 3 + 2] = vertices[i].z;
+	}
+	if (q->atlas != -1 && !_static.layoutChanged) {
+		writeStaticQuad(q);
+	}
+}
+
+void RenderGL::setStaticQuadTexture(int num, int primitive, const uint8_t *texData, int texW, int texH, int16_t texKey) {
+	assert(num >= 0 && num < _static.count);
+	StaticQuad *q = &_static.quads[num];
+	Texture *t = 0;
+	if (texData) {
+		t = getTexture(texData, texW, texH, texKey);
+	}
+	// the texture is kept in the atlas as long as a quad uses it
+	if (q->tex != t) {
+		if (q->tex) {
+			--q->tex->pinCount;
+		}
+		if (t) {
+			++t->pinCount;
+		}
+		q->tex = t;
+	}
+	q->primitive = primitive;
+	int atlas = -1;
+	if (t && getTexCoords(t, primitive, q->uv) == 4) {
+		atlas = t->atlas;
+	}
+	if (q->atlas != atlas) {
+		q->atlas = atlas;
+		_static.layoutChanged = true;
+	} else if (atlas != -1 && !_static.layoutChanged) {
+		writeStaticQuad(q);
+	}
+}
+
+void RenderGL::writeStaticQuad(const StaticQuad *q) {
+	static const int kQuadTriangles[] = { 0, 1, 2, 0, 2, 3 };
+	TexturedJobVertex *v = &_static.vertices[q->offset * 6];
+	for (int i = 0; i < 6; ++i) {
+		const int j = kQuadTriangles[i];
+		v[i].setJob(q->vertices[j * 3], q->vertices[j * 3 + 1], q->vertices[j * 3 + 2], q->uv[j * 2], q->uv[j * 2 + 1]);
+	}
+	if (_static.dirtyFirst == _static.dirtyLast) {
+		_static.dirtyFirst = q->offset;
+		_static.dirtyLast = q->offset + 1;
+	} else {
+		_static.dirtyFirst = MIN(_static.dirtyFirst, q->offset);
+		_static.dirtyLast = MAX(_static.dirtyLast, q->offset + 1);
+	}
+}
+
+void RenderGL::updateStaticQuadsLayout() {
+	memset(_static.atlasCount, 0, sizeof(_static.atlasCount));
+	for (int i = 0; i < _static.count; ++i) {
+		const int atlas = _static.quads[i].atlas;
+		if (atlas != -1) {
+			++_static.atlasCount[atlas];
+		}
+	}
+	int offset = 0;
+	int next[kMaxAtlases];
+	for (int i = 0; i < kMaxAtlases; ++i) {
+		_static.atlasOffset[i] = next[i] = offset;
+		offset += _static.atlasCount[i];
+	}
+	for (int i = 0; i < _static.count; ++i) {
+		StaticQuad *q = &_static.quads[i];
+		if (q->atlas != -1) {
+			q->offset = next[q->atlas]++;
+			writeStaticQuad(q);
+		}
+	}
+#ifdef USE_VBO
+	glBufferData(GL_ARRAY_BUFFER, offset * 6 * sizeof(TexturedJobVertex), _static.vertices, GL_STATIC_DRAW);
+#endif
+	_static.dirtyFirst = _static.dirtyLast = 0;
+	_static.layoutChanged = false;
+}
+
+// the quads of an atlas are stored in the order of their numbers, the consecutive
+// quads of the mask are drawn with a single call
+void RenderGL::drawStaticQuadsRuns(int atlas, const uint8_t *quadsMask) {
+	int first = 0, count = 0;
+	for (int i = 0; i < _static.count; ++i) {
+		const StaticQuad *q = &_static.quads[i];
+		if (q->atlas != atlas || !quadsMask[i]) {
+			continue;
+		}
+		if (count != 0 && q->offset != first + count) {
+			drawArrays(GL_TRIANGLES, first * 6, count * 6);
+			count = 0;
+		}
+		if (count == 0) {
+			first = q->offset;
+		}
+		++count;
+	}
+	if (count != 0) {
+		drawArrays(GL_TRIANGLES, first * 6, count * 6);
+	}
+}
+
+void RenderGL::drawStaticQuads(const uint8_t *quadsMask) {
+	if (_static.count == 0) {
+		return;
+	}
+	const uint8_t *base = (const uint8_t *)_static.vertices;
+#ifdef USE_VBO
+	glBindBuffer(GL_ARRAY_BUFFER, _static.vbo);
+	base = 0;
+#endif
+	if (_static.layoutChanged) {
+		updateStaticQuadsLayout();
+	} else if (_static.dirtyFirst != _static.dirtyLast) {
+		// animated textures, only the texture coordinates changed
+#ifdef USE_VBO
+		const int size = sizeof(TexturedJobVertex) * 6;
+		glBufferSubData(GL_ARRAY_BUFFER, _static.dirtyFirst * size, (_static.dirtyLast - _static.dirtyFirst) * size, &_static.vertices[_static.dirtyFirst * 6]);
+#endif
+		_static.dirtyFirst = _static.dirtyLast = 0;
+	}
+	setVertexPointer(3, sizeof(TexturedJobVertex), base + offsetof(TexturedJobVertex, x));
+	setTexCoordPointer(sizeof(TexturedJobVertex), base + offsetof(TexturedJobVertex, u));
+	for (int i = 0; i < kMaxAtlases; ++i) {
+		if (_static.atlasCount[i] != 0) {
+			beginTexturedDraw(_textureCache.getAtlasTexture(i));
+			if (!quadsMask) {
+				drawArrays(GL_TRIANGLES, _static.atlasOffset[i] * 6, _static.atlasCount[i] * 6);
+			} else {
+				drawStaticQuadsRuns(i, quadsMask);
+			}
+			endTexturedDraw();
+		}
+	}
+#ifdef USE_VBO
+	glBindBuffer(GL_ARRAY_BUFFER, 0);
+#endif
+}
+
+void RenderGL::beginObjectDraw(int x, int y, int z, int ry, int shift) {
+	if (isBatching) {
+		// the vertices are transformed on the CPU and drawn with the scene
+		Matrix4f *m = &_objectBatch.transform;
+		const GLfloat div = 1 << shift;
+		m->identity();
+		m->translate(x / div, y / div, z / div);
+		m->rotate(ry * 360 / 1024., 0., 1., 0.);
+		m->scale(1 / 8., 1 / 2., 1 / 8.);
+		_objectBatch.active = true;
+		return;
+	}
+	assert(_matrix.modelViewTop < MAX_MATRICES - 1);
+	Matrix4f *m = &_matrix.modelView[_matrix.modelViewTop + 1];
+	*m = _matrix.modelView[_matrix.modelViewTop];
+	++_matrix.modelViewTop;
 	const GLfloat div = 1 << shift;
-	glTranslatef(x / div, y / div, z / div);
-	glRotatef(ry * 360 / 1024., 0., 1., 0.);
-	glScalef(1 / 8., 1 / 2., 1 / 8.);
+	m->translate(x / div, y / div, z / div);
+	m->rotate(ry * 360 / 1024., 0., 1., 0.);
+	m->scale(1 / 8., 1 / 2., 1 / 8.);
+	loadModelViewMatrix(*m);
 	
-	setupJobList();
+	setupTexJobList();
 }
 
-void Render::endObjectDraw() {
-	flushJobList();
+void RenderGL::endObjectDraw() {
+	if (_objectBatch.active) {
+		_objectBatch.active = false;
+		return;
+	}
+	flushTexJobList();
 	
-	glPopMatrix();
+	assert(_matrix.modelViewTop > 0);
+	--_matrix.modelViewTop;
+	loadModelViewMatrix(_matrix.modelView[_matrix.modelViewTop]);
 }
 
-void Render::updateFrustrumPlanes() {
-	Matrix4f clip, proj, modl;
-	glGetFloatv(GL_PROJECTION_MATRIX, proj.t);
-	glGetFloatv(GL_MODELVIEW_MATRIX, modl.t);
-	Matrix4f::mul(modl, proj, clip);
-	// extract right,left,top,bottom,far,near planes
-	const GLfloat *v = &clip.t[0];
-	int i = 0;
-	while (i < 6) {
-		_frustum[i].x = clip.t[3]  - v[0];
-		_frustum[i].y = clip.t[7]  - v[4];
-		_frustum[i].z = clip.t[11] - v[8];
-		_frustum[i].w = clip.t[15] - v[12];
-		_frustum[i].normalize();
-		++i;
-		_frustum[i].x = clip.t[3]  + v[0];
-		_frustum[i].y = clip.t[7]  + v[4];
-		_frustum[i].z = clip.t[11] + v[8];
-		_frustum[i].w = clip.t[15] + v[12];
-		_frustum[i].normalize();
-		++i;
-		++v;
-	}
+// the stack is reset, GL is left in the GL_MODELVIEW mode
+void RenderGL::loadMatrices() {
+	_matrix.modelViewTop = 0;
+	loadProjectionMatrix(_matrix.projection);
+	loadModelViewMatrix(_matrix.modelView[0]);
+}
+
+void RenderGL::updateFrustrumPlanes() {
+	Render::updateFrustrumPlanes(_matrix.projection, _matrix.modelView[_matrix.modelViewTop]);
 }
 
 bool Render::isQuadInFrustrum(const Vertex *vertices, int verticesCount) {
 	assert(verticesCount == 4);
-	bool ret = false;
-	while (verticesCount-- && !ret) {
-		ret = true;
-		for (int i = 0; i < 6; ++i) {
-			if (_frustum[i].x * vertices->x + _frustum[i].y * vertices->y + _frustum[i].z * vertices->z + _frustum[i].w <= 0) {
-				ret = false;
-				break;
-			}
+	for (int i = 0; i < verticesCount; ++i) {
+		if (Frustum_isPointInside(&_frustumPlanes, vertices[i].x, vertices[i].y, vertices[i].z)) {
+			return true;
 		}
-		++vertices;
 	}
-	return ret;
+	return false;
 }
 
 bool Render::isBoxInFrustrum(const Vertex *vertices, int verticesCount) {
@@ -617,13 +1779,43 @@ bool Render::isBoxInFrustrum(const Vertex *vertices, int verticesCount) {
 	return true;
 }
 
-void Render::setOverlayBlendColor(int r, int g, int b) {
+// axis aligned box, same result as isBoxInFrustrum() with its 8 corners for
+// kFrustrumOutside. kFrustrumInside if all the corners are in the frustum.
+int Render::testBoxInFrustrum(const Vertex *boxMin, const Vertex *boxMax) {
+	int ret = kFrustrumInside;
+	for (int i = 0; i < 6; ++i) {
+		// corners the farthest along and against the plane normal
+		const Vertex *px = (_frustum[i].x > 0) ? boxMax : boxMin;
+		const Vertex *py = (_frustum[i].y > 0) ? boxMax : boxMin;
+		const Vertex *pz = (_frustum[i].z > 0) ? boxMax : boxMin;
+		if (_frustum[i].x * px->x + _frustum[i].y * py->y + _frustum[i].z * pz->z + _frustum[i].w <= 0) {
+			return kFrustrumOutside;
+		}
+		const Vertex *nx = (_frustum[i].x > 0) ? boxMin : boxMax;
+		const Vertex *ny = (_frustum[i].y > 0) ? boxMin : boxMax;
+		const Vertex *nz = (_frustum[i].z > 0) ? boxMin : boxMax;
+		if (_frustum[i].x * nx->x + _frustum[i].y * ny->y + _frustum[i].z * nz->z + _frustum[i].w <= 0) {
+			ret = kFrustrumIntersect;
+		}
+	}
+	return ret;
+}
+
+void Render::testBoxesInFrustrum(const FrustumBoxes *boxes, uint8_t *results) {
+	Frustum_testBoxes(&_frustumPlanes, boxes, results);
+}
+
+void Render::testPointsInFrustrum(const float *x, const float *y, const float *z, int count, uint8_t *inside) {
+	Frustum_testPoints(&_frustumPlanes, x, y, z, count, inside);
+}
+
+void RenderGL::setOverlayBlendColor(int r, int g, int b) {
 	_overlay.r = r;
 	_overlay.g = g;
 	_overlay.b = b;
 }
 
-void Render::setOverlayDim(int w, int h, bool hflip) {
+void RenderGL::setOverlayDim(int w, int h, bool hflip) {
 	if (_overlay.tex) {
 		_textureCache.destroyTexture(_overlay.tex);
 		_overlay.tex = 0;
@@ -633,10 +1825,18 @@ void Render::setOverlayDim(int w, int h, bool hflip) {
 	}
 	memset(_overlay.buf, 0, kOverlayBufSize);
 	_overlay.tex = _textureCache.createTexture(_overlay.buf, w, h);
+	if (!_overlay.tex && evictTextures(w, h)) {
+		_overlay.tex = _textureCache.createTexture(_overlay.buf, w, h);
+	}
+	if (!_overlay.tex) {
+		warning("Unable to allocate the %dx%d overlay texture", w, h);
+	}
 	_overlay.hflip = hflip;
+	_overlay.drawnY0 = _overlay.drawnY1 = 0;
+	_overlay.clearedY0 = _overlay.clearedY1 = 0;
 }
 
-void Render::setPalette(const uint8_t *pal, int count) {
+void RenderGL::setPalette(const uint8_t *pal, int count) {
 	for (int i = 0; i < count; ++i) {
 		const int r = pal[0];
 		const int g = pal[1];
@@ -653,31 +1853,34 @@ void Render::setPalette(const uint8_t *pal, int count) {
 	_textureCache.setPalette(_clut);
 }
 
-void Render::clearScreen() {
+void RenderGL::clearScreen() {
 	glClearColor(0, 0, 0, 0);
 	glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
 }
 
-static void setPerspective(GLfloat fovy, GLfloat aspect, GLfloat znear, GLfloat zfar) {
-	const GLfloat y = znear * tan(fovy * M_PI / 360.);
-	const GLfloat x = y * aspect;
-	glFrustum(-x, x, -y, y, znear, zfar);
-}
-
-void Render::setupProjection(int mode) {
-	glEnableClientState(GL_VERTEX_ARRAY);
-	glEnableClientState(GL_TEXTURE_COORD_ARRAY);
+void RenderGL::setupProjection(int mode) {
+#ifdef USE_SHADERS
+	if (_glsl.enabled) {
+		// the texture coordinates are enabled by beginTexturedDraw
+		glEnableVertexAttribArray(kAttribPosition);
+	} else
+#endif
+	{
+		glEnableClientState(GL_VERTEX_ARRAY);
+		glEnableClientState(GL_TEXTURE_COORD_ARRAY);
+	}
 
 	if (mode == kProjMenu) {
-		glMatrixMode(GL_PROJECTION);
-		glLoadIdentity();
-		setPerspective(45., 1.6, 1., 128.);
-		glTranslatef(0., 0., -24.);
-		glRotatef(20., 1., 0., 0.);
-		glMatrixMode(GL_MODELVIEW);
-		glLoadIdentity();
-		glScalef(1., -.5, 1.);
-		glTranslatef(0., 0., -64.);
+		Matrix4f *proj = &_matrix.projection;
+		proj->identity();
+		proj->perspective(45., 1.6, 1., 128.);
+		proj->translate(0., 0., -24.);
+		proj->rotate(20., 1., 0., 0.);
+		Matrix4f *modl = &_matrix.modelView[0];
+		modl->identity();
+		modl->scale(1., -.5, 1.);
+		modl->translate(0., 0., -64.);
+		loadMatrices();
 		return;
 	}
 	clearScreen();
@@ -690,109 +1893,104 @@ void Render::setupProjection(int mode) {
 	if (mode == kProjDefault) {
 		return;
 	}
-	glMatrixMode(GL_PROJECTION);
-	glLoadIdentity();
-	setPerspective(45., 1.6, 1., 512.);
-	glTranslatef(0., 0., -24.);
-	glRotatef(20., 1., 0., 0.);
-	glMatrixMode(GL_MODELVIEW);
-	glLoadIdentity();
-	glScalef(1., -.5, -1.);
-	glRotatef(_cameraPitch, 0., 1., 0.);
+	Matrix4f *proj = &_matrix.projection;
+	proj->identity();
+	proj->perspective(45., 1.6, 1., 512.);
+	proj->translate(0., 0., -24.);
+	proj->rotate(20., 1., 0., 0.);
+	Matrix4f *modl = &_matrix.modelView[0];
+	modl->identity();
+	modl->scale(1., -.5, -1.);
+	modl->rotate(_cameraPitch, 0., 1., 0.);
 	_cameraPos.y = -24;
-	glTranslatef(-_cameraPos.x, _cameraPos.y, -_cameraPos.z);
+	modl->translate(-_cameraPos.x, _cameraPos.y, -_cameraPos.z);
+	loadMatrices();
 	updateFrustrumPlanes();
 }
 
-void Render::setupProjection2d() {
-	glMatrixMode(GL_PROJECTION);
-	glLoadIdentity();
-	glOrtho(0, 320, 200, 0, 0, 1);
-	glMatrixMode(GL_MODELVIEW);
-	glLoadIdentity();
+void RenderGL::setupProjection2d() {
+	_matrix.projection.identity();
+	_matrix.projection.ortho(0, 320, 200, 0, 0, 1);
+	_matrix.modelView[0].identity();
+	loadMatrices();
 }
 
-void Render::drawOverlay() {
+void RenderGL::drawOverlay() {
 	if (!kOverlayDisabled && _overlay.tex) {
-		_textureCache.updateTexture(_overlay.tex, _overlay.buf, _overlay.tex->bitmapW, _overlay.tex->bitmapH);
-		glMatrixMode(GL_PROJECTION);
-		glLoadIdentity();
+		// only the rows drawn this frame or cleared after the previous one changed
+		int y0 = _overlay.drawnY0;
+		int y1 = _overlay.drawnY1;
+		if (_overlay.clearedY0 != _overlay.clearedY1) {
+			if (y0 == y1) {
+				y0 = _overlay.clearedY0;
+				y1 = _overlay.clearedY1;
+			} else {
+				y0 = MIN(y0, _overlay.clearedY0);
+				y1 = MAX(y1, _overlay.clearedY1);
+			}
+		}
+		if (y0 != y1) {
+			_textureCache.updateTextureRows(_overlay.tex, _overlay.buf, y0, y1 - y0);
+		}
+		_matrix.projection.identity();
 		if (_overlay.hflip) {
-			glOrtho(0, _w, 0, _h, 0, 1);
+			_matrix.projection.ortho(0, _w, 0, _h, 0, 1);
+			_overlay.clearedY0 = _overlay.clearedY1 = 0;
 		} else {
-			glOrtho(0, _w, _h, 0, 0, 1);
-			memset(_overlay.buf, 0, kOverlayBufSize);
+			_matrix.projection.ortho(0, _w, _h, 0, 0, 1);
+			const int pitch = _overlay.tex->bitmapW;
+			memset(_overlay.buf + _overlay.drawnY0 * pitch, 0, (_overlay.drawnY1 - _overlay.drawnY0) * pitch);
+			_overlay.clearedY0 = _overlay.drawnY0;
+			_overlay.clearedY1 = _overlay.drawnY1;
 		}
-		glMatrixMode(GL_MODELVIEW);
-		glLoadIdentity();
+		_overlay.drawnY0 = _overlay.drawnY1 = 0;
+		_matrix.modelView[0].identity();
+		loadMatrices();
 		glDisable(GL_DEPTH_TEST);
-		glEnable(GL_TEXTURE_2D);
-		glBindTexture(GL_TEXTURE_2D, _overlay.tex->id);
+		beginTexturedDraw(_overlay.tex->id);
 		const GLfloat tU = _overlay.tex->u;
 		const GLfloat tV = _overlay.tex->v;
 		assert(tU != 0. && tV != 0.);
 		GLfloat uv[] = { _overlay.tex->x, _overlay.tex->y, tU, _overlay.tex->y, tU, tV, _overlay.tex->x, tV };
 		emitQuadTex2i(0, 0, _w, _h, uv);
 		glEnable(GL_DEPTH_TEST);
-		glDisable(GL_TEXTURE_2D);
+		endTexturedDraw();
 	}
 	if (_overlay.r != 255 || _overlay.g != 255 || _overlay.b != 255) {
-		glColor4f(_overlay.r / 255., _overlay.g / 255., _overlay.b / 255., .8);
+		setColor(_overlay.r / 255., _overlay.g / 255., _overlay.b / 255., .8);
 		emitQuad2i(0, 0, _w, _h);
-		glColor4f(1., 1., 1., 1.);
+		setColor(1., 1., 1., 1.);
 		_overlay.r = _overlay.g = _overlay.b = 255;
 	}
+	_frameStats.drawCallsCount = _drawCallsCount;
+	_frameStats.trianglesCount = _trianglesCount;
+	_frameStats.texUploadsCount = _textureCache._uploadsCount;
+	_frameStats.atlasUsage = _textureCache.getAtlasUsage();
+	_frameStats.atlasesCount = _textureCache._atlasesCount;
+	_frameStats.texEvictionsCount = _textureCache._evictionsCount;
+	_drawCallsCount = _trianglesCount = 0;
+	_textureCache._uploadsCount = 0;
+	_textureCache._evictionsCount = 0;
+	PROFILE_GL_FRAME();
 }
 
-void Render::setupJobList()
-{	
-	JobCount = 0;
-	isBatching = 1;
-}
-
-void Render::setupTexJobList()
+void RenderGL::setupTexJobList()
 {
-	for (int i=0; i < MAX_ATLASES; i++) {
-		TexturedJobCount[i] = 0;		
-	}
+	_commands.count = 0;
+	_texturedJobs.count = 0;
+	_flatJobs.count = 0;
 	
 	isBatching = 1;
 }
 
-void Render::flushTexJobList()
+void RenderGL::flushTexJobList()
 {
-	for (int i=0; i < MAX_ATLASES; i++) {
-		if (TexturedJobCount[i]) {
-			glEnable(GL_TEXTURE_2D);
-			glBindTexture(GL_TEXTURE_2D, i+1);
-			glVertexPointer(3, GL_FLOAT, sizeof(TexturedJobVertex), &TexturedJobList[i][0][0].x);
-			glTexCoordPointer(2, GL_FLOAT, sizeof(TexturedJobVertex), &TexturedJobList[i][0][0].u);
-			glDrawArrays(GL_TRIANGLES, 0, TexturedJobCount[i] * 3);
-			glDisable(GL_TEXTURE_2D);
-			
-			TexturedJobCount[i] = 0;
-		}			
-	}
-	
-	isBatching = 0;
-}
-
-void Render::flushJobList()
-{
-	//TODO:: render all triangles
-	if (JobCount > 0)
-	{
-		glEnable(GL_COLOR_ARRAY);
-		glVertexPointer(3, GL_FLOAT, sizeof(JobVertex), &JobList[0][0].x);
-		glColorPointer(4, GL_FLOAT, sizeof(JobVertex), &JobList[0][0].r);
-		glDrawArrays(GL_TRIANGLES, 0, JobCount*3);
-		glDisable(GL_COLOR_ARRAY);
-	}
+	drawCommands();
 	
 	isBatching = 0;
 }
 
-const uint8_t *Render::captureScreen(int *w, int *h) {
+const uint8_t *RenderGL::captureScreen(int *w, int *h) {
 	if (!_screenshotBuf) {
 		_screenshotBuf = (uint8_t *)calloc(_w * _h, 3);
 	}
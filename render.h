@@ -7,6 +7,8 @@
 #define RENDER_H__
 
 #include "util.h"
+#include "frustum.h"
+#include "matrix.h"
 
 enum {
 	kFlatColorRed = 512,
@@ -24,66 +26,91 @@ enum {
 	kProjDefault
 };
 
-struct Texture;
+enum {
+	kRenderGL = 0,
+	kRenderNull,     // discards all draws, no GL context required
+	kRenderRecord,   // as kRenderNull, serializes the draw calls to a file
+	kRenderGLSL      // as kRenderGL, with shaders instead of the fixed-function pipeline
+};
+
+// counters of the last completed frame, updated by drawOverlay()
+struct RenderStats {
+	int drawCallsCount;
+	int trianglesCount;
+	int texUploadsCount;
+	int atlasUsage; // percentage of the atlas texels allocated
+	int atlasesCount;
+	int texEvictionsCount;
+};
 
 struct Render {
-	uint8_t _clut[256 * 3];
-	float _pixelColorMap[4][256];
 	int _w, _h;
-	uint8_t *_screenshotBuf;
-	struct {
-		uint8_t *buf;
-		Texture *tex;
-		bool hflip;
-		int r, g, b;
-	} _overlay;
 	struct {
 		bool changed;
 		int pw;
 		int ph;
 	} _viewport;
+	struct {
+		float x, y, z;
+	} _cameraPos;
+	float _cameraPitch;
+	bool _batchObjects; // draw the scene objects with the ground and walls
+	Vertex4f _frustum[6];
+	FrustumPlanes _frustumPlanes;
+	RenderStats _frameStats;
 
-	uint8_t isBatching;
-	
 	Render();
-	~Render();
+	virtual ~Render();
 
-	void flushCachedTextures();
+	virtual void flushCachedTextures() = 0;
 
 	void setCameraPos(int x, int y, int z, int shift = 0);
 	void setCameraPitch(int a);
 
-	void drawPolygonFlat(const Vertex *vertices, int verticesCount, int color);
-	void drawPolygonTexture(const Vertex *vertices, int verticesCount, int primitive, const uint8_t *texData, int texW, int texH, int16_t texKey);
-	void _drawPolygonFlat(const Vertex *vertices, int verticesCount, int color);
-	void _drawPolygonTexture(const Vertex *vertices, int verticesCount, int primitive, const uint8_t *texData, int texW, int texH, int16_t texKey);
-	void drawParticle(const Vertex *pos, int color);
-	void drawSprite(int x, int y, const uint8_t *texData, int texW, int texH, int16_t texKey);
-	void drawRectangle(int x, int y, int w, int h, int color);
+	virtual void drawPolygonFlat(const Vertex *vertices, int verticesCount, int color) = 0;
+	virtual void drawPolygonTexture(const Vertex *vertices, int verticesCount, int primitive, const uint8_t *texData, int texW, int texH, int16_t texKey) = 0;
+	virtual void drawParticles(const Vertex *pos, const uint8_t *colors, int count) = 0;
+	virtual void drawSprite(int x, int y, const uint8_t *texData, int texW, int texH, int16_t texKey) = 0;
+	virtual void drawRectangle(int x, int y, int w, int h, int color) = 0;
+
+	// level ground and walls, uploaded once and drawn with a single call per
+	// atlas. A quad is hidden until it is given a texture (or if texData is 0).
+	// When 'quadsMask' is set, only the quads with a non-zero entry are drawn.
+	virtual void initStaticQuads(int count) = 0;
+	virtual void setStaticQuad(int num, const Vertex *vertices) = 0;
+	virtual void setStaticQuadTexture(int num, int primitive, const uint8_t *texData, int texW, int texH, int16_t texKey) = 0;
+	virtual void drawStaticQuads(const uint8_t *quadsMask = 0) = 0;
 
-	void beginObjectDraw(int x, int y, int z, int ry, int shift = 0);
-	void endObjectDraw();
+	virtual void beginObjectDraw(int x, int y, int z, int ry, int shift = 0) = 0;
+	virtual void endObjectDraw() = 0;
 
-	void updateFrustrumPlanes();
+	void updateFrustrumPlanes(const Matrix4f &proj, const Matrix4f &modl);
 	bool isQuadInFrustrum(const Vertex *vertices, int verticesCount);
 	bool isBoxInFrustrum(const Vertex *vertices, int verticesCount);
+	int testBoxInFrustrum(const Vertex *boxMin, const Vertex *boxMax);
+	void testBoxesInFrustrum(const FrustumBoxes *boxes, uint8_t *results);
+	void testPointsInFrustrum(const float *x, const float *y, const float *z, int count, uint8_t *inside);
+
+	virtual void setOverlayBlendColor(int r, int g, int b) = 0;
+	virtual void setOverlayDim(int w, int h, bool hflip = false) = 0;
+	virtual void copyToOverlay(int x, int y, const uint8_t *data, int pitch, int w, int h, int transparentColor = -1) = 0;
 
-	void setOverlayBlendColor(int r, int g, int b);
-	void setOverlayDim(int w, int h, bool hflip = false);
-	void copyToOverlay(int x, int y, const uint8_t *data, int pitch, int w, int h, int transparentColor = -1);
-
-	void setPalette(const uint8_t *pal, int count);
-	void clearScreen();
-	void setupProjection(int mode = kProjGame);
-	void setupProjection2d();
-	void drawOverlay();
-	void resizeScreen(int w, int h);
-	
-	void setupJobList();
-	void flushJobList();
-	void setupTexJobList();
-	void flushTexJobList();
-	const uint8_t *captureScreen(int *w, int *h);
+	virtual void setPalette(const uint8_t *pal, int count) = 0;
+	virtual void clearScreen() = 0;
+	virtual void setupProjection(int mode = kProjGame) = 0;
+	virtual void setupProjection2d() = 0;
+	virtual void drawOverlay() = 0;
+	virtual void resizeScreen(int w, int h);
+
+	virtual void setupTexJobList() = 0;
+	virtual void flushTexJobList() = 0;
+	virtual const uint8_t *captureScreen(int *w, int *h) = 0;
 };
 
+int Render_parseBackend(const char *name); // returns -1 if unknown
+// 'atlasSize' is the dimension of the texture atlases, 0 for the default
+Render *Render_create(int backend, int atlasSize = 0);
+Render *RenderGL_create(bool shaders = false, int atlasSize = 0);
+Render *RenderNull_create(bool record);
+
 #endif // RENDER_H__
@@ -0,0 +1,260 @@
+/*
+ * Fade To Black engine rewrite
+ * Copyright (C) 2006-2012 Gregory Montoir (cyx@users.sourceforge.net)
+ */
+
+#include "file.h"
+#include "render.h"
+
+//
+// GPU-less backends : the projection and frustum planes are computed on the
+// CPU so that the culling (and the objects draw list filled from it) is the
+// same as with the OpenGL backend.
+//
+
+static const char *kRecordFileName = "f2bgl-render.rec";
+
+// each record starts with one of these bytes, values are little-endian
+enum {
+	kRecFrame = 0,
+	kRecPolygonFlat,
+	kRecPolygonTexture,
+	kRecParticle,
+	kRecSprite,
+	kRecRectangle,
+	kRecBeginObject,
+	kRecEndObject
+};
+
+struct RenderNull : Render {
+	struct StaticQuad {
+		Vertex vertices[4];
+		int primitive;
+		int16_t texKey;
+		int texW, texH;
+		bool visible;
+	};
+
+	File *_fp;
+	uint32_t _frame;
+	RenderStats _stats; // one draw call per primitive, there is no batching
+	StaticQuad *_staticQuads;
+	int _staticQuadsCount;
+
+	RenderNull(bool record);
+	virtual ~RenderNull();
+
+	void writeVertices(const Vertex *vertices, int verticesCount);
+
+	virtual void flushCachedTextures();
+
+	virtual void drawPolygonFlat(const Vertex *vertices, int verticesCount, int color);
+	virtual void drawPolygonTexture(const Vertex *vertices, int verticesCount, int primitive, const uint8_t *texData, int texW, int texH, int16_t texKey);
+	virtual void drawParticles(const Vertex *pos, const uint8_t *colors, int count);
+	virtual void drawSprite(int x, int y, const uint8_t *texData, int texW, int texH, int16_t texKey);
+	virtual void drawRectangle(int x, int y, int w, int h, int color);
+
+	virtual void initStaticQuads(int count);
+	virtual void setStaticQuad(int num, const Vertex *vertices);
+	virtual void setStaticQuadTexture(int num, int primitive, const uint8_t *texData, int texW, int texH, int16_t texKey);
+	virtual void drawStaticQuads(const uint8_t *quadsMask);
+
+	virtual void beginObjectDraw(int x, int y, int z, int ry, int shift);
+	virtual void endObjectDraw();
+
+	virtual void setOverlayBlendColor(int r, int g, int b) {}
+	virtual void setOverlayDim(int w, int h, bool hflip) {}
+	virtual void copyToOverlay(int x, int y, const uint8_t *data, int pitch, int w, int h, int transparentColor) {}
+
+	virtual void setPalette(const uint8_t *pal, int count) {}
+	virtual void clearScreen() {}
+	virtual void setupProjection(int mode);
+	virtual void setupProjection2d() {}
+	virtual void drawOverlay();
+
+	virtual void setupTexJobList() {}
+	virtual void flushTexJobList() {}
+	virtual const uint8_t *captureScreen(int *w, int *h) { return 0; }
+};
+
+Render *RenderNull_create(bool record) {
+	return new RenderNull(record);
+}
+
+RenderNull::RenderNull(bool record)
+	: _fp(0), _frame(0), _staticQuads(0), _staticQuadsCount(0) {
+	memset(&_stats, 0, sizeof(_stats));
+	if (record) {
+		_fp = fileOpen(kRecordFileName, 0, kFileType_DUMP, false);
+		if (!_fp) {
+			warning("Unable to open '%s' for writing", kRecordFileName);
+		}
+	}
+}
+
+RenderNull::~RenderNull() {
+	if (_fp) {
+		fileClose(_fp);
+	}
+	memFree(_staticQuads);
+}
+
+void RenderNull::flushCachedTextures() {
+	initStaticQuads(0);
+}
+
+void RenderNull::writeVertices(const Vertex *vertices, int verticesCount) {
+	fileWriteByte(_fp, verticesCount);
+	for (int i = 0; i < verticesCount; ++i) {
+		fileWriteUint16LE(_fp, vertices[i].x);
+		fileWriteUint16LE(_fp, vertices[i].y);
+		fileWriteUint16LE(_fp, vertices[i].z);
+	}
+}
+
+void RenderNull::drawPolygonFlat(const Vertex *vertices, int verticesCount, int color) {
+	++_stats.drawCallsCount;
+	_stats.trianglesCount += verticesCount - 2;
+	if (_fp) {
+		fileWriteByte(_fp, kRecPolygonFlat);
+		fileWriteUint16LE(_fp, color);
+		writeVertices(vertices, verticesCount);
+	}
+}
+
+void RenderNull::drawPolygonTexture(const Vertex *vertices, int verticesCount, int primitive, const uint8_t *texData, int texW, int texH, int16_t texKey) {
+	++_stats.drawCallsCount;
+	_stats.trianglesCount += verticesCount - 2;
+	if (_fp) {
+		fileWriteByte(_fp, kRecPolygonTexture);
+		fileWriteByte(_fp, primitive);
+		fileWriteUint16LE(_fp, texKey);
+		fileWriteUint16LE(_fp, texW);
+		fileWriteUint16LE(_fp, texH);
+		writeVertices(vertices, verticesCount);
+	}
+}
+
+void RenderNull::drawParticles(const Vertex *pos, const uint8_t *colors, int count) {
+	++_stats.drawCallsCount;
+	if (_fp) {
+		for (int i = 0; i < count; ++i) {
+			fileWriteByte(_fp, kRecParticle);
+			fileWriteByte(_fp, colors[i]);
+			writeVertices(&pos[i], 1);
+		}
+	}
+}
+
+void RenderNull::drawSprite(int x, int y, const uint8_t *texData, int texW, int texH, int16_t texKey) {
+	++_stats.drawCallsCount;
+	_stats.trianglesCount += 2;
+	if (_fp) {
+		fileWriteByte(_fp, kRecSprite);
+		fileWriteUint16LE(_fp, x);
+		fileWriteUint16LE(_fp, y);
+		fileWriteUint16LE(_fp, texKey);
+		fileWriteUint16LE(_fp, texW);
+		fileWriteUint16LE(_fp, texH);
+	}
+}
+
+void RenderNull::drawRectangle(int x, int y, int w, int h, int color) {
+	++_stats.drawCallsCount;
+	_stats.trianglesCount += 2;
+	if (_fp) {
+		fileWriteByte(_fp, kRecRectangle);
+		fileWriteUint16LE(_fp, x);
+		fileWriteUint16LE(_fp, y);
+		fileWriteUint16LE(_fp, w);
+		fileWriteUint16LE(_fp, h);
+		fileWriteByte(_fp, color);
+	}
+}
+
+void RenderNull::initStaticQuads(int count) {
+	memFree(_staticQuads);
+	_staticQuads = (count > 0) ? ALLOC_TAGGED<StaticQuad>(kMemTag_GEOMETRY, count) : 0;
+	_staticQuadsCount = count;
+}
+
+void RenderNull::setStaticQuad(int num, const Vertex *vertices) {
+	assert(num >= 0 && num < _staticQuadsCount);
+	memcpy(_staticQuads[num].vertices, vertices, sizeof(_staticQuads[num].vertices));
+}
+
+void RenderNull::setStaticQuadTexture(int num, int primitive, const uint8_t *texData, int texW, int texH, int16_t texKey) {
+	assert(num >= 0 && num < _staticQuadsCount);
+	StaticQuad *q = &_staticQuads[num];
+	q->primitive = primitive;
+	q->texKey = texKey;
+	q->texW = texW;
+	q->texH = texH;
+	q->visible = (texData != 0);
+}
+
+void RenderNull::drawStaticQuads(const uint8_t *quadsMask) {
+	if (_staticQuadsCount == 0) {
+		return;
+	}
+	++_stats.drawCallsCount;
+	for (int i = 0; i < _staticQuadsCount; ++i) {
+		const StaticQuad *q = &_staticQuads[i];
+		if (!q->visible || (quadsMask && !quadsMask[i])) {
+			continue;
+		}
+		_stats.trianglesCount += 2;
+		if (_fp) {
+			fileWriteByte(_fp, kRecPolygonTexture);
+			fileWriteByte(_fp, q->primitive);
+			fileWriteUint16LE(_fp, q->texKey);
+			fileWriteUint16LE(_fp, q->texW);
+			fileWriteUint16LE(_fp, q->texH);
+			writeVertices(q->vertices, 4);
+		}
+	}
+}
+
+void RenderNull::beginObjectDraw(int x, int y, int z, int ry, int shift) {
+	if (_fp) {
+		fileWriteByte(_fp, kRecBeginObject);
+		fileWriteUint32LE(_fp, x);
+		fileWriteUint32LE(_fp, y);
+		fileWriteUint32LE(_fp, z);
+		fileWriteUint16LE(_fp, ry);
+		fileWriteByte(_fp, shift);
+	}
+}
+
+void RenderNull::endObjectDraw() {
+	if (_fp) {
+		fileWriteByte(_fp, kRecEndObject);
+	}
+}
+
+void RenderNull::setupProjection(int mode) {
+	if (mode != kProjGame) {
+		return;
+	}
+	Matrix4f proj, modl;
+	proj.identity();
+	proj.perspective(45., 1.6, 1., 512.);
+	proj.translate(0., 0., -24.);
+	proj.rotate(20., 1., 0., 0.);
+	modl.identity();
+	modl.scale(1., -.5, -1.);
+	modl.rotate(_cameraPitch, 0., 1., 0.);
+	_cameraPos.y = -24;
+	modl.translate(-_cameraPos.x, _cameraPos.y, -_cameraPos.z);
+	updateFrustrumPlanes(proj, modl);
+}
+
+void RenderNull::drawOverlay() {
+	if (_fp) {
+		fileWriteByte(_fp, kRecFrame);
+		fileWriteUint32LE(_fp, _frame);
+	}
+	++_frame;
+	_frameStats = _stats;
+	memset(&_stats, 0, sizeof(_stats));
+}
@@ -31,6 +31,8 @@ Resource::Resource() {
 	memset(_musicKeyPathsTable, 0, sizeof(_musicKeyPathsTable));
 	_demoInputDataSize = 0;
 	_demoInputData = 0;
+	_demoHeader = false;
+	_demoLevel = _demoRandSeed = -1;
 }
 
 Resource::~Resource() {
@@ -366,13 +368,13 @@ void Resource::loadLevelData(const char *levelName, int levelNum) {
 		// free previously loaded data
 		for (uint32_t j = 0; j < _treesTableCount[type]; ++j) {
 			ResTreeNode *node = &_treesTable[type][j];
-			free(node->data);
+			memFree(node->data);
 			memset(node, 0, sizeof(ResTreeNode));
 		}
-		free(_treesTable[type]);
+		memFree(_treesTable[type]);
 
 		// load new level data
-		_treesTable[type] = ALLOC<ResTreeNode>(count);
+		_treesTable[type] = ALLOC_TAGGED<ResTreeNode>(kMemTag_RESOURCE, count);
 		_treesTableCount[type] = count;
 		for (uint32_t j = 0; j < count; ++j) {
 			ResTreeNode *node = &_treesTable[type][j];
@@ -384,7 +386,7 @@ void Resource::loadLevelData(const char *levelName, int levelNum) {
 			node->dataOffset = 4 + count * 12 + offs;
 			if (size != 0) {
 				node->dataSize = size;
-				node->data = (uint8_t *)malloc(size);
+				node->data = (uint8_t *)memAlloc(kMemTag_RESOURCE, size);
 				if (node->data) {
 					const uint32_t pos = fileGetPos(fp);
 					fileSetPos(fp, node->dataOffset, kFilePosition_SET);
@@ -431,7 +433,7 @@ void Resource::unload(int type, int16_t key) {
 	assert(key > 0 && key < _treesTableCount[type]);
 	ResTreeNode *node = &_treesTable[type][key];
 	if (node->data) {
-		free(node->data);
+		memFree(node->data);
 		node->data = 0;
 	}
 	node->dataSize = 0;
@@ -619,10 +621,31 @@ void Resource::loadDEM(File *fp, int dataSize) {
 	_demoInputDataSize = dataSize / 8;
 	free(_demoInputData);
 	_demoInputData = ALLOC<ResDemoInput>(_demoInputDataSize);
+	_demoLevel = _demoRandSeed = -1;
+	_demoHeader = false;
 	for (int i = 0; i < _demoInputDataSize; ++i) {
 		ResDemoInput *input = &_demoInputData[i];
 		input->ticks = fileReadUint32LE(fp);
 		input->key = fileReadUint16LE(fp);
-		input->pressed = fileReadUint16LE(fp) != 0;
+		const int value = fileReadUint16LE(fp);
+		input->pressed = value != 0;
+		// recorded files start with 3 entries for key 0, ignored by the playback
+		if (input->ticks == 0 && input->key == 0) {
+			switch (i) {
+			case 0:
+				_demoHeader = (value == kDemoHeaderMagic);
+				break;
+			case 1:
+				if (_demoHeader) {
+					_demoLevel = value;
+				}
+				break;
+			case 2:
+				if (_demoHeader) {
+					_demoRandSeed = value;
+				}
+				break;
+			}
+		}
 	}
 }
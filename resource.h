@@ -75,6 +75,10 @@ struct ResDemoInput {
 	bool pressed;
 };
 
+enum {
+	kDemoHeaderMagic = 0x4632 // 'F2', first entry of the recorded .DEM files
+};
+
 struct Resource {
 	ResTreeNode *_treesTable[kResTypeCount];
 	uint16_t _treesTableCount[kResTypeCount];
@@ -98,6 +102,8 @@ struct Resource {
 	char _musicKeyPathsTable[kMusicKeyPathsTableSize][kKeyPathNameLength];
 	int _demoInputDataSize;
 	ResDemoInput *_demoInputData;
+	bool _demoHeader; // recorded file, the ticks are relative to the level start
+	int _demoLevel, _demoRandSeed;
 
 	Resource();
 	~Resource();
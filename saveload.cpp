@@ -9,11 +9,24 @@ static const char *kSaveText = "1.00 Aug 25 1995  09:11:45 (c) 1995 Delphine Sof
 static int kHeaderSize = 96;
 static int kSaveVersion = 21;
 
+static const char *kStateHashFn = "f2bgl-statehash.bin";
+
 enum {
 	kModeSave,
 	kModeLoad,
+	kModeHash, // fp is unused, the values are accumulated in _stateHash
 };
 
+// FNV-1a
+static uint32_t _stateHash;
+
+static void hashValue(uint32_t value) {
+	for (int i = 0; i < 4; ++i) {
+		_stateHash = (_stateHash ^ (value & 255)) * 16777619;
+		value >>= 8;
+	}
+}
+
 #define P(x, type) \
 	template <int M> \
 	static void persist(File *fp, type &value) { \
@@ -21,6 +34,8 @@ enum {
 			value = fileRead ## x (fp); \
 		} else if (M == kModeSave) { \
 			fileWrite ## x (fp, value); \
+		} else if (M == kModeHash) { \
+			hashValue(value); \
 		} \
 	} \
 
@@ -44,6 +59,8 @@ static void persistPtr(File *fp, const T *&ptr, const T *base) {
 		const uint32_t offset = base && ptr ? uint32_t(ptr - base) : kPtr;
 		assert(offset == kPtr || (offset & 0x80000000) == 0);
 		fileWriteUint32LE(fp, offset);
+	} else if (M == kModeHash) {
+		hashValue(base && ptr ? uint32_t(ptr - base) : kPtr);
 	}
 }
 
@@ -79,7 +96,7 @@ static void persistCellMap(File *fp, CellMap &m) {
 		CollisionSlot *slot = m.colSlot;
 		while (slot) {
 			CollisionSlot *next = slot->next;
-			free(slot);
+			memFree(slot);
 			slot = next;
 		}
 		m.colSlot = 0;
@@ -148,9 +165,9 @@ static void persistMap(File *fp, Game &g) {
 
 template <int M>
 static void persistGameObjectPtrByKey(File *fp, Game &g, GameObject *&o) {
-	if (M == kModeSave) {
+	if (M == kModeSave || M == kModeHash) {
 		int16_t objKey = o ? o->objKey : -1;
-		persist<kModeSave>(fp, objKey);
+		persist<M>(fp, objKey);
 	} else if (M == kModeLoad) {
 		int16_t objKey = -1;
 		persist<kModeLoad>(fp, objKey);
@@ -176,7 +193,7 @@ static void persistGameMessage(File *fp, GameMessage &m) {
 template <int M>
 static void persistGameMessageList(File *fp, GameObject *o) {
 	int count = 0;
-	if (M == kModeSave) {
+	if (M == kModeSave || M == kModeHash) {
 		for (GameMessage *m = o->msg; m; m = m->next) {
 			++count;
 		}
@@ -186,13 +203,13 @@ static void persistGameMessageList(File *fp, GameObject *o) {
 		GameMessage *msg = o->msg;
 		while (msg) {
 			GameMessage *next = msg->next;
-			free(msg);
+			memFree(msg);
 			msg = next;
 		}
 		o->msg = 0;
 		GameMessage *prev = 0;
 		for (int i = 0; i < count; ++i) {
-			GameMessage *m = (GameMessage *)calloc(1, sizeof(GameMessage));
+			GameMessage *m = (GameMessage *)memCalloc(kMemTag_MESSAGE, 1, sizeof(GameMessage));
 			if (!prev) {
 				o->msg = m;
 			} else {
@@ -289,13 +306,13 @@ template <int M>
 static void persistObjects(File *fp, Game &g) {
 	for (int i = 0; i < ARRAYSIZE(g._objectKeysTable); ++i) {
 		GameObject *o = g._objectKeysTable[i];
-		if (M == kModeSave) {
+		if (M == kModeSave || M == kModeHash) {
 			if (o) {
-				persist<kModeSave>(fp, o->objKey);
-				persistGameObject<kModeSave>(fp, g, o);
+				persist<M>(fp, o->objKey);
+				persistGameObject<M>(fp, g, o);
 			} else {
 				int16_t objKey = -1;
-				persist<kModeSave>(fp, objKey);
+				persist<M>(fp, objKey);
 			}
 		} else if (M == kModeLoad) {
 			int16_t objKey = -1;
@@ -475,6 +492,23 @@ static void persistMusic(File *fp, Game &g) {
 	persist<M>(fp, g._snd._musicKey);
 }
 
+template <int M>
+static void persistParticles(File *fp, Game &g) {
+	ParticlesTable &p = g._particles;
+	persist<M>(fp, p.count);
+	for (int i = 0; i < p.count; ++i) {
+		persist<M>(fp, p.xPos[i]);
+		persist<M>(fp, p.yPos[i]);
+		persist<M>(fp, p.zPos[i]);
+		persist<M>(fp, p.dx[i]);
+		persist<M>(fp, p.dy[i]);
+		persist<M>(fp, p.dz[i]);
+		persist<M>(fp, p.fl[i]);
+		persist<M>(fp, p.ticks[i]);
+		persist<M>(fp, p.speed[i]);
+	}
+}
+
 template <int M>
 static void persistGameState(File *fp, Game &g) {
 	pad<M>(fp, sizeof(uint32_t));
@@ -523,10 +557,53 @@ void Game::loadGameState(int num) {
 			initLevel();
 		}
 		persistGameState<kModeLoad>(fp, *this);
+		initStaticSceneQuads();
+		initScenePvs();
 	}
 	fileClose(fp);
 }
 
+uint32_t Game::getStateHash() {
+	_stateHash = 2166136261U;
+	persist<kModeHash>(0, _level);
+	persistGameState<kModeHash>(0, *this);
+	persistParticles<kModeHash>(0, *this);
+	return _stateHash;
+}
+
+void Game::initStateHash() {
+	if (_params.stateHash == kStateHashCheck) {
+		_stateHashFp = fileOpen(kStateHashFn, 0, kFileType_LOAD, false);
+	} else {
+		_stateHashFp = fileOpen(kStateHashFn, 0, kFileType_DUMP, false);
+	}
+	if (!_stateHashFp) {
+		warning("Unable to open '%s'", kStateHashFn);
+	}
+	_stateHashDiverged = false;
+}
+
+void Game::updateStateHash() {
+	const uint32_t hash = getStateHash();
+	if (_params.stateHash == kStateHashCheck) {
+		if (_stateHashDiverged) {
+			return;
+		}
+		const uint32_t refTicks = fileReadUint32LE(_stateHashFp);
+		const uint32_t refHash = fileReadUint32LE(_stateHashFp);
+		if (fileEof(_stateHashFp)) {
+			warning("State hash reference ends at tick %d", _ticks);
+			_stateHashDiverged = true;
+		} else if (refTicks != (uint32_t)_ticks || refHash != hash) {
+			warning("State hash diverges at tick %d level %d (0x%08x, reference tick %d 0x%08x)", _ticks, _level, hash, refTicks, refHash);
+			_stateHashDiverged = true;
+		}
+	} else {
+		fileWriteUint32LE(_stateHashFp, _ticks);
+		fileWriteUint32LE(_stateHashFp, hash);
+	}
+}
+
 void Game::saveScreenshot(int num) {
 	char filename[32];
 	snprintf(filename, sizeof(filename), kFn, _level + 1, num, "bmp");
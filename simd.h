@@ -0,0 +1,24 @@
+/*
+ * Fade To Black engine rewrite
+ * Copyright (C) 2006-2012 Gregory Montoir (cyx@users.sourceforge.net)
+ */
+
+#ifndef SIMD_H__
+#define SIMD_H__
+
+//
+// F2B_SSE2 or F2B_NEON is defined when the compiler targets the instruction
+// set, the code using the intrinsics must have a scalar fallback. Building
+// with -DF2B_NO_SIMD selects the scalar code.
+//
+
+#if defined(F2B_NO_SIMD)
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#define F2B_SSE2
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+#include <arm_neon.h>
+#define F2B_NEON
+#endif
+
+#endif // SIMD_H__
@@ -6,7 +6,8 @@
 #include "decoder.h"
 #include "spritecache.h"
 
-SpriteCache::SpriteCache() {
+SpriteCache::SpriteCache()
+	: _hitsCount(0), _missesCount(0) {
 	memset(_entries, 0, sizeof(_entries));
 }
 
@@ -16,7 +17,7 @@ SpriteCache::~SpriteCache() {
 
 void SpriteCache::flush() {
 	for (int i = 0; i < ARRAYSIZE(_entries); ++i) {
-		free(_entries[i].data);
+		memFree(_entries[i].data);
 	}
 	memset(_entries, 0, sizeof(_entries));
 }
@@ -25,15 +26,17 @@ uint8_t *SpriteCache::getData(int16_t key, const uint8_t *src) {
 	assert(key >= 0 && key < ARRAYSIZE(_entries));
 	if (_entries[key].data) {
 		if (src == _entries[key].src) {
+			++_hitsCount;
 			return _entries[key].data;
 		}
 		warning("Invalid cache entry for key %d", key);
-		free(_entries[key].data);
+		memFree(_entries[key].data);
 		_entries[key].data = 0;
 	}
+	++_missesCount;
 	const int size = READ_LE_UINT16(src); src += 2;
 	const int packedSize = READ_LE_UINT16(src); src += 2;
-	uint8_t *dst = (uint8_t *)malloc(size);
+	uint8_t *dst = (uint8_t *)memAlloc(kMemTag_SPRITECACHE, size);
 	if (dst) {
 		if (size > packedSize) {
 			decodeLZSS(src, dst, size);
@@ -11,6 +11,7 @@ struct SpriteCache {
 		const uint8_t *src;
 		uint8_t *data;
 	} _entries[3072];
+	int _hitsCount, _missesCount;
 
 	SpriteCache();
 	~SpriteCache();
@@ -7,6 +7,7 @@
 #include "file.h"
 #include "game.h"
 #include "mixer.h"
+#include "profiler.h"
 #include "sound.h"
 #include "render.h"
 #include "stub.h"
@@ -17,10 +18,23 @@ static const char *USAGE =
 	"  --datapath=PATH             Path to data files (default '.')\n"
 	"  --language=EN|FR|GR|SP|IT   Language files to use (default 'EN')\n"
 	"  --playdemo                  Use inputs from .DEM files\n"
+	"  --recorddemo                Record inputs to .DEM files in the save path\n"
+	"  --dumphash                  Write the game state hash of each tick\n"
+	"  --checkhash                 Compare the game state hashes with a previous dump\n"
 	"  --level=NUM                 Start at level NUM\n"
 	"  --voice=EN|FR|GR            Voice files (default 'EN')\n"
 	"  --subtitles                 Display cutscene subtitles\n"
-	"  --savepath=PATH             Path to save files (default '.')\n";
+	"  --savepath=PATH             Path to save files (default '.')\n"
+	"  --render=GL|GLSL|NULL|RECORD Rendering backend (default 'GL')\n"
+	"  --memstats                  Print the memory usage per subsystem at each level\n"
+	"  --perfhud                   Display the performance counters (toggle with Ctrl P)\n"
+	"  --batch-objects             Draw the 3D objects with the level geometry batches\n"
+	"  --atlas-size=NUM            Dimension of the texture atlases (default 2048)\n"
+#ifdef F2B_PROFILE
+	"  --profile=CSV|TRACE         Dump the tick phases timings on exit\n"
+	"  --profile-scripts           Report the script opcodes timings on level change\n"
+#endif
+	;
 
 static const struct {
 	FileLanguage lang;
@@ -140,6 +154,11 @@ struct GameStub_F2B : GameStub {
 		GameParams params;
 		char *language = 0;
 		char *voice = 0;
+		int renderBackend = kRenderGL;
+		bool memStats = false;
+		bool perfHud = false;
+		bool batchObjects = false;
+		int atlasSize = 0;
 		while (1) {
 			static struct option options[] = {
 				{ "datapath", required_argument, 0, 1 },
@@ -149,6 +168,18 @@ struct GameStub_F2B : GameStub {
 				{ "voice",    required_argument, 0, 5 },
 				{ "subtitles", no_argument,      0, 6 },
 				{ "savepath", required_argument, 0, 7 },
+				{ "render",   required_argument, 0, 8 },
+				{ "recorddemo", no_argument,     0, 11 },
+				{ "dumphash", no_argument,       0, 12 },
+				{ "checkhash", no_argument,      0, 13 },
+				{ "memstats", no_argument,       0, 14 },
+				{ "perfhud",  no_argument,       0, 15 },
+				{ "batch-objects", no_argument,  0, 16 },
+				{ "atlas-size", required_argument, 0, 17 },
+#ifdef F2B_PROFILE
+				{ "profile",  required_argument, 0, 9 },
+				{ "profile-scripts", no_argument, 0, 10 },
+#endif
 #ifdef F2B_DEBUG
 				{ "xpos_conrad",    required_argument, 0, 100 },
 				{ "zpos_conrad",    required_argument, 0, 101 },
@@ -183,6 +214,42 @@ struct GameStub_F2B : GameStub {
 			case 7:
 				_savePath = strdup(optarg);
 				break;
+			case 8:
+				renderBackend = Render_parseBackend(optarg);
+				if (renderBackend < 0) {
+					warning("Unknown rendering backend '%s'", optarg);
+					renderBackend = kRenderGL;
+				}
+				break;
+			case 11:
+				params.recordDemo = true;
+				break;
+			case 12:
+				params.stateHash = kStateHashDump;
+				break;
+			case 13:
+				params.stateHash = kStateHashCheck;
+				break;
+			case 14:
+				memStats = true;
+				break;
+			case 15:
+				perfHud = true;
+				break;
+			case 16:
+				batchObjects = true;
+				break;
+			case 17:
+				atlasSize = atoi(optarg);
+				break;
+#ifdef F2B_PROFILE
+			case 9:
+				Profiler_init(strcasecmp(optarg, "TRACE") == 0 ? kProfOutput_TRACE : kProfOutput_CSV);
+				break;
+			case 10:
+				Profiler_enableScripts();
+				break;
+#endif
 #ifdef F2B_DEBUG
 			case 100:
 				params.xPosConrad = atoi(optarg);
@@ -200,6 +267,9 @@ struct GameStub_F2B : GameStub {
 			}
 		}
 		g_utilDebugMask = kDebug_INFO;
+		if (memStats) {
+			g_utilDebugMask |= kDebug_MEMORY;
+		}
 #ifdef F2B_DEBUG
 		g_utilDebugMask |= kDebug_GAME /* | kDebug_RESOURCE */ | kDebug_FILE | kDebug_CUTSCENE | kDebug_OPCODES | kDebug_SOUND;
 		_skipCutscenes = 1;
@@ -214,8 +284,10 @@ struct GameStub_F2B : GameStub {
 			warning("Unable to find datafiles");
 			return -2;
 		}
-		_render = new Render;
+		_render = Render_create(renderBackend, atlasSize);
+		_render->_batchObjects = batchObjects;
 		_g = new Game(_render, &params);
+		_g->_perfHud.enabled = perfHud;
 		_g->init();
 		_g->_cut._numToPlay = 47;
 		_state = -1;
@@ -229,6 +301,12 @@ struct GameStub_F2B : GameStub {
 		return 0;
 	}
 	virtual void quit() {
+#ifdef F2B_PROFILE
+		Profiler_dump();
+		Profiler_printScriptsReport();
+		Profiler_printGLReport();
+#endif
+		memPrintStats("on exit", false);
 		delete _g;
 		delete _render;
 		free(_dataPath);
@@ -300,6 +378,9 @@ struct GameStub_F2B : GameStub {
 		case kKeyCodeCheatLifeCounter:
 			_g->_cheats ^= kCheatLifeCounter;
 			break;
+		case kKeyCodePerfHud:
+			_g->_perfHud.enabled = !_g->_perfHud.enabled;
+			break;
 		}
 	}
 	bool syncTicks(unsigned int ticks, int tickDuration) {
@@ -416,6 +497,12 @@ struct GameStub_F2B : GameStub {
 		_slotState = slot;
 		_loadState = true;
 	}
+	virtual int getLevel() {
+		return _g->_level;
+	}
+	virtual bool hasDemoInput() {
+		return _g->_res._demoInputDataSize != 0 && _g->_demoInput < _g->_res._demoInputDataSize;
+	}
 };
 
 extern "C" {
@@ -32,6 +32,7 @@ enum {
 	kKeyCode4,       // item #4
 	kKeyCode5,       // item #5
 	kKeyCodeCheatLifeCounter,
+	kKeyCodePerfHud,
 };
 
 struct GameStub {
@@ -44,6 +45,8 @@ struct GameStub {
 	virtual void drawGL() = 0;
 	virtual void loadState(int slot) = 0;
 	virtual void saveState(int slot) = 0;
+	virtual int getLevel() = 0;
+	virtual bool hasDemoInput() = 0;
 };
 
 extern "C" {
@@ -8,6 +8,7 @@
 #else
 #include <SDL_opengl.h>
 #endif
+#include "glwrap.h"
 #include "scaler.h"
 #include "texturecache.h"
 #include <iostream>
@@ -15,6 +16,8 @@
 #include <SDL.h>
 
 static const int kDefaultTexBufSize = 320 * 200;
+static const int kDefaultAtlasSize = 2048;
+static const int kMinAtlasSize = 512; // fits the 320x200 overlay
 static const int kTextureMinMaxFilter = GL_NEAREST; // GL_NEAREST
 
 uint16_t convert_RGBA_5551(int r, int g, int b) {
@@ -25,12 +28,14 @@ uint16_t convert_BGRA_1555(int r, int g, int b) {
 	return 0x8000 | ((r >> 3) << 10) | ((g >> 3) << 5) | (b >> 3);
 }
 
-static const struct {
+struct TextureFormat {
 	int internal;
 	int format;
 	int type;
 	uint16_t (*convertColor)(int, int, int);
-} _formats[] = {
+};
+
+static const TextureFormat _formats[] = {
 #ifdef __amigaos4__
 	{ GL_RGB5_A1, GL_BGRA, GL_UNSIGNED_SHORT_1_5_5_5_REV, &convert_BGRA_1555 },
 #endif
@@ -42,6 +47,9 @@ static const struct {
 	{ -1, -1, -1, 0 }
 };
 
+// palette indexes, the colors are looked up by the fragment shader when drawing
+static const TextureFormat _indexedFormat = { GL_LUMINANCE, GL_LUMINANCE, GL_UNSIGNED_BYTE, 0 };
+
 static const struct {
 	void (*proc)(uint16_t *dst, int dstPitch, const uint16_t *src, int srcPitch, int w, int h);
         int factor;
@@ -55,7 +63,7 @@ static const struct {
 
 static const int _scaler = 0;
 
-Atlas::Atlas(GLint maxTexSz, int fmt, Atlas *next)
+Atlas::Atlas(GLint size, const TextureFormat *fmt)
 {
 	glGenTextures(1, &this->tex);
 	glBindTexture(GL_TEXTURE_2D, this->tex);
@@ -66,10 +74,17 @@ Atlas::Atlas(GLint maxTexSz, int fmt, Atlas *next)
 	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
 	glPixelStorei(GL_PACK_ALIGNMENT, 1);
 	glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
-	glTexImage2D(GL_TEXTURE_2D, 0, _formats[fmt].internal, maxTexSz, maxTexSz, 0, _formats[fmt].format, _formats[fmt].type, NULL);
+	glTexImage2D(GL_TEXTURE_2D, 0, fmt->internal, size, size, 0, fmt->format, fmt->type, NULL);
 	glBindTexture(GL_TEXTURE_2D, 0);
 	
-	tree = new AtlasNode(0, 0, maxTexSz, maxTexSz);
+	this->size = size;
+	tree = new AtlasNode(0, 0, size, size);
+}
+
+void Atlas::clear()
+{
+	delete tree;
+	tree = new AtlasNode(0, 0, size, size);
 }
 
 Atlas::~Atlas()
@@ -134,18 +149,37 @@ void AtlasNode::splitNode(int w, int h)
 
 TextureCache::TextureCache()
 	: _fmt(0), _texturesListHead(0), _texturesListTail(0) {
+	memset(_texturesTable, 0, sizeof(_texturesTable));
 	memset(_clut, 0, sizeof(_clut));
 	if (_scalers[_scaler].factor != 1) {
-		_texBuf = (uint16_t *)malloc(kDefaultTexBufSize * sizeof(uint16_t));
+		_texBuf = (uint16_t *)memAlloc(kMemTag_TEXTURE, kDefaultTexBufSize * sizeof(uint16_t));
 	} else {
 		_texBuf = 0;
 	}
+	_uploadBuf = 0;
+	_uploadBufSize = 0;
 	_npotTex = false;
+	_indexed = false;
+	_paletteTex = 0;
+	memset(_palette, 0, sizeof(_palette));
+	_uploadsCount = 0;
+	_evictionsCount = 0;
+	memset(_atlases, 0, sizeof(_atlases));
+	_atlasesCount = 0;
+	_atlasSize = 0;
+	_atlasUsedArea = 0;
 }
 
 TextureCache::~TextureCache() {
-	free(_texBuf);
+	memFree(_texBuf);
+	memFree(_uploadBuf);
 	flush();
+	for (int i = 0; i < _atlasesCount; ++i) {
+		delete _atlases[i];
+	}
+	if (_paletteTex) {
+		glDeleteTextures(1, &_paletteTex);
+	}
 }
 
 static bool hasExt(const char *exts, const char *name) {
@@ -157,66 +191,89 @@ static bool hasExt(const char *exts, const char *name) {
 	return false;
 }
 
-void TextureCache::init() {
+static int roundPow2(int sz) {
+	if (sz != 0 && (sz & (sz - 1)) == 0) {
+		return sz;
+	}
+	int textureSize = 1;
+	while (textureSize < sz) {
+		textureSize <<= 1;
+	}
+	return textureSize;
+}
+
+void TextureCache::init(bool indexed, int atlasSize) {
 	const char *exts = (const char *)glGetString(GL_EXTENSIONS);
 	if (exts && hasExt(exts, "GL_ARB_texture_non_power_of_two")) {
 		_npotTex = true;
 	}
 	
 	glGetIntegerv(GL_MAX_TEXTURE_SIZE, &maxTexSz);
-	maxTexSz = 4096;
-	atlas = new Atlas(maxTexSz, _fmt, NULL);
+	_atlasSize = roundPow2(atlasSize > 0 ? atlasSize : kDefaultAtlasSize);
+	// the driver limit is applied last, an atlas larger than it can not be created
+	_atlasSize = MIN(MAX(_atlasSize, kMinAtlasSize), (int)maxTexSz);
+	debug(kDebug_INFO, "Atlas size %d (max texture size %d)", _atlasSize, maxTexSz);
+	// the indexes can not be interpolated by the scalers
+	_indexed = indexed && _scalers[_scaler].factor == 1;
+	_atlases[0] = new Atlas(_atlasSize, getFormat());
+	_atlasesCount = 1;
+	if (_indexed) {
+		glGenTextures(1, &_paletteTex);
+		glBindTexture(GL_TEXTURE_2D, _paletteTex);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+		glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, 256, 1, 0, GL_RGBA, GL_UNSIGNED_BYTE, _palette);
+		glBindTexture(GL_TEXTURE_2D, 0);
+	}
+}
+
+const TextureFormat *TextureCache::getFormat() const {
+	return _indexed ? &_indexedFormat : &_formats[_fmt];
 }
 
 void TextureCache::flush() {
 	Texture *t = _texturesListHead;
 	while (t) {
 		Texture *next = t->next;
-		free(t->bitmapData);
+		memFree(t->bitmapData);
 		delete t;
 		t = next;
 	}
 	_texturesListHead = _texturesListTail = 0;
+	memset(_texturesTable, 0, sizeof(_texturesTable));
 	memset(_clut, 0, sizeof(_clut));
-	delete atlas;
-	
-	atlas = new Atlas(maxTexSz, _fmt, NULL);
+	// the first atlas is kept, the others are allocated again when needed
+	for (int i = 1; i < _atlasesCount; ++i) {
+		delete _atlases[i];
+		_atlases[i] = 0;
+	}
+	if (_atlases[0]) {
+		_atlases[0]->clear();
+		_atlasesCount = 1;
+	}
+	_atlasUsedArea = 0;
 }
 
 Texture *TextureCache::getCachedTexture(const uint8_t *data, int w, int h, int16_t key) {
-	Texture *prev = 0;
-	for (Texture *t = _texturesListHead; t; t = t->next) {
-		if (t->key == key) {
-			if (prev) { // move to head
-				prev->next = t->next;
-				t->next = _texturesListHead;
-				_texturesListHead = t;
-				if (t == _texturesListTail) {
-					_texturesListTail = prev;
-				}
-			}
-			return t;
+	assert(key >= 0 && key < kMaxTextureKeys);
+	Texture *t = _texturesTable[key];
+	if (t) {
+		if (t != _texturesListHead) { // move to head
+			unlinkTexture(t);
+			linkTexture(t);
 		}
-		prev = t;
+		return t;
 	}
-	Texture *t = createTexture(data, w, h);
+	t = createTexture(data, w, h);
 	if (t) {
 		t->key = key;
+		_texturesTable[key] = t;
 	}
 	return t;
 }
 
-static int roundPow2(int sz) {
-	if (sz != 0 && (sz & (sz - 1)) == 0) {
-		return sz;
-	}
-	int textureSize = 1;
-	while (textureSize < sz) {
-		textureSize <<= 1;
-	}
-	return textureSize;
-}
-
 void TextureCache::convertTexture(const uint8_t *src, int w, int h, const uint16_t *clut, uint16_t *dst, int dstPitch) {
 	if (_scalers[_scaler].factor == 1) {
 		for (int y = 0; y < h; ++y) {
@@ -238,91 +295,246 @@ void TextureCache::convertTexture(const uint8_t *src, int w, int h, const uint16
 	}
 }
 
+// places the texture in the first atlas with room, a new atlas is created if none has
+bool TextureCache::allocTexture(Texture *t) {
+	const int w = t->texW;
+	const int h = t->texH;
+	if (w > _atlasSize || h > _atlasSize) {
+		return false;
+	}
+	for (int i = 0; i < kMaxAtlases; ++i) {
+		if (i == _atlasesCount) {
+			_atlases[i] = new Atlas(_atlasSize, getFormat());
+			++_atlasesCount;
+			debug(kDebug_INFO, "TextureCache::allocTexture() %d atlases", _atlasesCount);
+		}
+		AtlasNode *node = _atlases[i]->tree->findFreeNode(w, h);
+		if (node) {
+			node->splitNode(w, h);
+			_atlasUsedArea += w * h;
+			t->atlas = i;
+			t->id = _atlases[i]->tex;
+			t->texX = node->x;
+			t->texY = node->y;
+			t->x = t->texX / (float)_atlasSize;
+			t->y = t->texY / (float)_atlasSize;
+			t->u = t->x + t->texW / (float)_atlasSize;
+			t->v = t->y + t->texH / (float)_atlasSize;
+			return true;
+		}
+	}
+	return false;
+}
+
 Texture *TextureCache::createTexture(const uint8_t *data, int w, int h) {
-	AtlasNode *node = NULL;
 	Texture *t = new Texture;
 	t->bitmapW = w;
 	t->bitmapH = h;
-	t->bitmapData = (uint8_t *)malloc(w * h);
+	t->bitmapData = (uint8_t *)memAlloc(kMemTag_TEXTURE, w * h);
 	if (!t->bitmapData) {
 		delete t;
 		return 0;
 	}
 	
 	memcpy(t->bitmapData, data, w * h);
-	w *= _scalers[_scaler].factor;
-	h *= _scalers[_scaler].factor;
-	
-	node = atlas->tree->findFreeNode(w, h);
-	if (!node) {
+	t->texW = w * _scalers[_scaler].factor;
+	t->texH = h * _scalers[_scaler].factor;
+	t->pinCount = 0;
+	if (!allocTexture(t)) {
+		memFree(t->bitmapData);
+		delete t;
 		return 0;
 	}
-	node->splitNode(w, h);
-	
-	t->texX = node->x;
-	t->texY = node->y;
-	t->texW = w;
-	t->texH = h;
-	t->x = t->texX / (float)maxTexSz;
-	t->y = t->texY / (float)maxTexSz;
-	t->u = t->x + t->texW / (float)maxTexSz;
-	t->v = t->y + t->texH / (float)maxTexSz;
-	
-	t->id = atlas->tex;
 	
 	glGetError();
 	
-	uint16_t *texData = (uint16_t *)malloc(t->texW * t->texH * sizeof(uint16_t));
-	convertTexture(t->bitmapData, t->bitmapW, t->bitmapH, _clut, texData, t->texW);
-	glBindTexture(GL_TEXTURE_2D, atlas->tex);
-	glTexSubImage2D(GL_TEXTURE_2D, 0, t->texX, t->texY, t->texW, t->texH, _formats[_fmt].format, _formats[_fmt].type, texData);
-	glBindTexture(GL_TEXTURE_2D, 0);
+	uploadTextureRows(t, 0, t->bitmapH);
 	
-	if (!_texturesListHead) {
-		_texturesListHead = _texturesListTail = t;
-	} else {
-		_texturesListTail->next = t;
-		_texturesListTail = t;
-	}
-	t->next = 0;
+	linkTexture(t);
 	t->key = -1;		
 	
-	free(texData);
 	return t;
 }
 
-void TextureCache::destroyTexture(Texture *texture) {
-	free(texture->bitmapData);
-	if (texture == _texturesListHead) {
-		_texturesListHead = texture->next;
-		if (texture == _texturesListTail) {
-			_texturesListTail = _texturesListHead;
-		}
+// the list is kept in the order of use, the most recent first
+void TextureCache::linkTexture(Texture *t) {
+	t->prev = 0;
+	t->next = _texturesListHead;
+	if (_texturesListHead) {
+		_texturesListHead->prev = t;
 	} else {
-		for (Texture *t = _texturesListHead; t; t = t->next) {
-			if (t->next == texture) {
-				t->next = texture->next;
-				if (texture == _texturesListTail) {
-					_texturesListTail = t;
-				}
-				break;
+		_texturesListTail = t;
+	}
+	_texturesListHead = t;
+}
+
+void TextureCache::unlinkTexture(Texture *t) {
+	if (t->prev) {
+		t->prev->next = t->next;
+	} else {
+		_texturesListHead = t->next;
+	}
+	if (t->next) {
+		t->next->prev = t->prev;
+	} else {
+		_texturesListTail = t->prev;
+	}
+	t->prev = t->next = 0;
+}
+
+static int compareTextureHeight(const void *a, const void *b) {
+	const Texture *t1 = *(const Texture **)a;
+	const Texture *t2 = *(const Texture **)b;
+	if (t1->texH != t2->texH) {
+		return t2->texH - t1->texH;
+	}
+	return t2->texW - t1->texW;
+}
+
+// the textures are placed again in the atlases, the tallest first. The ones
+// not fitting anymore are evicted.
+void TextureCache::repackTextures(Texture **textures, int count) {
+	for (int i = 0; i < _atlasesCount; ++i) {
+		_atlases[i]->clear();
+	}
+	_atlasUsedArea = 0;
+	qsort(textures, count, sizeof(Texture *), compareTextureHeight);
+	// the pinned textures first, they can not be evicted : with all the atlases
+	// empty (and created as needed), failing to place them means they do not fit
+	// in kMaxAtlases and their texture coordinates would be left stale
+	for (int pass = 0; pass < 2; ++pass) {
+		for (int i = 0; i < count; ++i) {
+			Texture *t = textures[i];
+			if (isEvictable(t) != (pass == 1)) {
+				continue;
+			}
+			if (allocTexture(t)) {
+				uploadTextureRows(t, 0, t->bitmapH);
+			} else if (isEvictable(t)) {
+				destroyTexture(t);
+				++_evictionsCount;
+			} else {
+				error("TextureCache::repackTextures() unable to place pinned texture %dx%d", t->texW, t->texH);
 			}
 		}
 	}
+}
+
+bool TextureCache::isEvictable(const Texture *t) const {
+	// the textures not created by getCachedTexture (overlay) are owned by the caller
+	return t->key >= 0 && t->pinCount == 0;
+}
+
+bool TextureCache::hasFreeNode(int w, int h) const {
+	for (int i = 0; i < _atlasesCount; ++i) {
+		if (_atlases[i]->tree->findFreeNode(w, h)) {
+			return true;
+		}
+	}
+	return _atlasesCount < kMaxAtlases && w <= _atlasSize && h <= _atlasSize;
+}
+
+// When the atlases are full, the least recently used textures are released
+// until a quarter of the texels (and at least a w x h texture) is available,
+// the remaining ones are packed again. The texture coordinates of all the
+// textures may change.
+bool TextureCache::evictTextures(int w, int h) {
+	w *= _scalers[_scaler].factor;
+	h *= _scalers[_scaler].factor;
+	if (w > _atlasSize || h > _atlasSize) {
+		return false;
+	}
+	int count = 0;
+	for (Texture *t = _texturesListHead; t; t = t->next) {
+		++count;
+	}
+	Texture **textures = (Texture **)memAlloc(kMemTag_TEXTURE, count * sizeof(Texture *));
+	if (!textures) {
+		return false;
+	}
+	count = 0;
+	for (Texture *t = _texturesListHead; t; t = t->next) {
+		textures[count++] = t;
+	}
+	const int64_t totalArea = (int64_t)_atlasesCount * _atlasSize * _atlasSize;
+	const int64_t targetArea = MAX((int64_t)w * h, totalArea / 4);
+	int64_t freeArea = totalArea - _atlasUsedArea;
+	for (int i = count - 1; i >= 0 && freeArea < targetArea; --i) {
+		Texture *t = textures[i];
+		if (isEvictable(t)) {
+			freeArea += t->texW * t->texH;
+			destroyTexture(t);
+			textures[i] = 0;
+			++_evictionsCount;
+		}
+	}
+	int n = 0;
+	for (int i = 0; i < count; ++i) {
+		if (textures[i]) {
+			textures[n++] = textures[i];
+		}
+	}
+	count = n;
+	repackTextures(textures, count);
+	memFree(textures);
+	debug(kDebug_INFO, "TextureCache::evictTextures() %d textures left, %d%% used", count, getAtlasUsage());
+	return hasFreeNode(w, h);
+}
+
+void TextureCache::destroyTexture(Texture *texture) {
+	memFree(texture->bitmapData);
+	unlinkTexture(texture);
+	if (texture->key >= 0) {
+		_texturesTable[texture->key] = 0;
+	}
 	delete texture;
 }
 
 void TextureCache::updateTexture(Texture *t, const uint8_t *data, int w, int h) {
 	assert(t->bitmapW == w && t->bitmapH == h);
-	memcpy(t->bitmapData, data, w * h);
-	uint16_t *texData = (uint16_t *)malloc(t->texW * t->texH * sizeof(uint16_t));
-	if (texData) {
-		convertTexture(t->bitmapData, t->bitmapW, t->bitmapH, _clut, texData, t->texW);
-		glBindTexture(GL_TEXTURE_2D, t->id);
-		glTexSubImage2D(GL_TEXTURE_2D, 0, t->texX, t->texY, t->texW, t->texH, _formats[_fmt].format, _formats[_fmt].type, texData);
-		glBindTexture(GL_TEXTURE_2D, 0);
-		free(texData);
+	updateTextureRows(t, data, 0, h);
+}
+
+// 'data' is the whole bitmap, only the rows y to y + h - 1 are uploaded
+void TextureCache::updateTextureRows(Texture *t, const uint8_t *data, int y, int h) {
+	assert(y >= 0 && y + h <= t->bitmapH);
+	const int w = t->bitmapW;
+	memcpy(t->bitmapData + y * w, data + y * w, w * h);
+	if (_scalers[_scaler].factor != 1) {
+		// the scalers interpolate with the neighbouring rows
+		y = 0;
+		h = t->bitmapH;
+	}
+	uploadTextureRows(t, y, h);
+}
+
+// converts the rows y to y + h - 1 of the texture bitmap and copies them to the atlas
+void TextureCache::uploadTextureRows(Texture *t, int y, int h) {
+	const int w = t->bitmapW;
+	const int factor = _scalers[_scaler].factor;
+	const void *texData = t->bitmapData + y * w;
+	if (!_indexed) {
+		const int size = t->texW * h * factor;
+		if (size > _uploadBufSize) {
+			uint16_t *buf = (uint16_t *)memRealloc(kMemTag_TEXTURE, _uploadBuf, size * sizeof(uint16_t));
+			if (!buf) {
+				return;
+			}
+			_uploadBuf = buf;
+			_uploadBufSize = size;
+		}
+		convertTexture(t->bitmapData + y * w, w, h, _clut, _uploadBuf, t->texW);
+		texData = _uploadBuf;
 	}
+	const TextureFormat *fmt = getFormat();
+	glBindTexture(GL_TEXTURE_2D, t->id);
+	glTexSubImage2D(GL_TEXTURE_2D, 0, t->texX, t->texY + y * factor, t->texW, h * factor, fmt->format, fmt->type, texData);
+	++_uploadsCount;
+	glBindTexture(GL_TEXTURE_2D, 0);
+}
+
+int TextureCache::getAtlasUsage() const {
+	return (int)(_atlasUsedArea * 100LL / ((int64_t)_atlasesCount * _atlasSize * _atlasSize));
 }
 
 void TextureCache::setPalette(const uint8_t *pal, bool updateTextures) {
@@ -330,23 +542,27 @@ void TextureCache::setPalette(const uint8_t *pal, bool updateTextures) {
 		const int r = pal[0];
 		const int g = pal[1];
 		const int b = pal[2];
+		_palette[i * 4] = r;
+		_palette[i * 4 + 1] = g;
+		_palette[i * 4 + 2] = b;
 		if (r == 0 && g == 0 && b == 0) {
 			_clut[i] = 0;
+			_palette[i * 4 + 3] = 0;
 		} else {
 			_clut[i] = _formats[_fmt].convertColor(r, g, b);
+			_palette[i * 4 + 3] = 255;
 		}
 	}
 	
-	if (updateTextures) {
+	if (_indexed) {
+		// the atlas texels are left untouched
+		glBindTexture(GL_TEXTURE_2D, _paletteTex);
+		glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, 256, 1, GL_RGBA, GL_UNSIGNED_BYTE, _palette);
+		++_uploadsCount;
+		glBindTexture(GL_TEXTURE_2D, 0);
+	} else if (updateTextures) {
 		for (Texture *t = _texturesListHead; t; t = t->next) {
-			uint16_t *texData = (uint16_t *)malloc(t->texW * t->texH * sizeof(uint16_t));
-			if (texData) {
-				convertTexture(t->bitmapData, t->bitmapW, t->bitmapH, _clut, texData, t->texW);
-				glBindTexture(GL_TEXTURE_2D, t->id);
-				glTexSubImage2D(GL_TEXTURE_2D, 0, t->texX, t->texY, t->texW, t->texH, _formats[_fmt].format, _formats[_fmt].type, texData);
-				glBindTexture(GL_TEXTURE_2D, 0);
-				free(texData);
-			}
+			uploadTextureRows(t, 0, t->bitmapH);
 		}
 	}
 }
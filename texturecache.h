@@ -8,16 +8,25 @@
 
 #include "util.h"
 
+enum {
+	kMaxAtlases = 4,
+	kMaxTextureKeys = 3072 // same bound as SpriteCache::_entries
+};
+
 struct Texture {
 	GLuint id;
+	int atlas; // index in TextureCache::_atlases
 	int bitmapW, bitmapH;
 	uint8_t *bitmapData;
 	int texX, texY;
 	int texW, texH;
 	float x, y;
 	float u, v;
-	Texture *next;
+	Texture *prev, *next; // TextureCache LRU list
 	int16_t key;
+	int pinCount; // pinned textures are never evicted, but can be moved
+
+	MEM_TAGGED_NEW(kMemTag_TEXTURE)
 };
 
 struct AtlasNode {
@@ -32,15 +41,23 @@ struct AtlasNode {
 	int w, h;
 	
 	AtlasNode *children[2];
+
+	MEM_TAGGED_NEW(kMemTag_ATLAS)
 };
 
+struct TextureFormat;
+
 struct Atlas {
-	Atlas(GLint maxTexSz, int fmt, Atlas *next);
+	Atlas(GLint size, const TextureFormat *fmt);
 	~Atlas();
+
+	void clear();
 	
 	GLuint tex;
+	int size;
 	AtlasNode *tree;
-	Atlas *next;
+
+	MEM_TAGGED_NEW(kMemTag_ATLAS)
 };
 
 struct TextureCache {
@@ -48,24 +65,48 @@ struct TextureCache {
 	TextureCache();
 	~TextureCache();
 
-	void init();
+	void init(bool indexed, int atlasSize = 0);
 	void flush();
 
 	Texture *getCachedTexture(const uint8_t *data, int w, int h, int16_t key);
 	void convertTexture(const uint8_t *src, int w, int h, const uint16_t *clut, uint16_t *dst, int dstPitch);
 	Texture *createTexture(const uint8_t *data, int w, int h);
+	bool allocTexture(Texture *);
+	void linkTexture(Texture *);
+	void unlinkTexture(Texture *);
 	void destroyTexture(Texture *);
+	bool isEvictable(const Texture *) const;
+	bool hasFreeNode(int w, int h) const;
+	bool evictTextures(int w, int h);
+	void repackTextures(Texture **textures, int count);
 	void updateTexture(Texture *, const uint8_t *data, int w, int h);
+	void updateTextureRows(Texture *, const uint8_t *data, int y, int h);
+	void uploadTextureRows(Texture *, int y, int h);
+	const TextureFormat *getFormat() const;
 
 	void setPalette(const uint8_t *pal, bool updateTextures = true);
 
+	int getAtlasUsage() const;
+	GLuint getAtlasTexture(int num) const { return _atlases[num]->tex; }
+
 	int _fmt;
 	GLint maxTexSz;
-	Atlas *atlas;
-	Texture *_texturesListHead, *_texturesListTail;
+	Atlas *_atlases[kMaxAtlases]; // allocated on demand
+	int _atlasesCount;
+	int _atlasSize;
+	Texture *_texturesListHead, *_texturesListTail; // most recently used first
+	Texture *_texturesTable[kMaxTextureKeys]; // indexed by key
 	uint16_t _clut[256];
 	uint16_t *_texBuf;
+	uint16_t *_uploadBuf; // kept between the updates
+	int _uploadBufSize;
 	bool _npotTex;
+	bool _indexed; // the atlas holds palette indexes, '_paletteTex' their colors
+	GLuint _paletteTex;
+	uint8_t _palette[256 * 4];
+	int _uploadsCount;
+	int _evictionsCount;
+	int _atlasUsedArea;
 };
 
 #endif // TEXTURECACHE_H__
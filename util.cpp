@@ -7,6 +7,7 @@
 #define WIN32_LEAN_AND_MEAN
 #include <windows.h>
 #endif
+#include <time.h>
 #include "util.h"
 
 int g_utilDebugMask = 0;
@@ -92,6 +93,123 @@ void error(const char *msg, ...) {
 	exit(-1);
 }
 
+struct MemBlockHeader {
+	uint32_t size;
+	uint32_t tag;
+	uint32_t magic;
+	uint32_t reserved; // keeps the returned pointer 16 bytes aligned
+};
+
+static const uint32_t kMemBlockMagic = 0x4D454D42; // 'MEMB'
+
+struct MemTagStats {
+	int64_t bytes;
+	int32_t blocks;
+	int64_t peakBytes;
+	int32_t peakBlocks;
+};
+
+static const char *_memTagNames[] = {
+	"Resource",
+	"SpriteCache",
+	"Texture",
+	"Atlas",
+	"GameMessage",
+	"CollisionSlot",
+	"Mixer",
+	"Cutscene",
+	"Geometry",
+	"MeshCache",
+	"RenderJobs"
+};
+
+// the mixer frees its queued buffers from the audio thread
+static MemTagStats _memTagStats[kMemTagsCount];
+
+static void memUpdateStats(int tag, int64_t bytes, int blocks) {
+	MemTagStats *ms = &_memTagStats[tag];
+	const int64_t curBytes = __atomic_add_fetch(&ms->bytes, bytes, __ATOMIC_RELAXED);
+	const int32_t curBlocks = __atomic_add_fetch(&ms->blocks, blocks, __ATOMIC_RELAXED);
+	int64_t peakBytes = __atomic_load_n(&ms->peakBytes, __ATOMIC_RELAXED);
+	while (curBytes > peakBytes && !__atomic_compare_exchange_n(&ms->peakBytes, &peakBytes, curBytes, true, __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+	}
+	int32_t peakBlocks = __atomic_load_n(&ms->peakBlocks, __ATOMIC_RELAXED);
+	while (curBlocks > peakBlocks && !__atomic_compare_exchange_n(&ms->peakBlocks, &peakBlocks, curBlocks, true, __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+	}
+}
+
+void *memAlloc(int tag, int size) {
+	assert(tag >= 0 && tag < kMemTagsCount);
+	MemBlockHeader *h = (MemBlockHeader *)malloc(sizeof(MemBlockHeader) + size);
+	if (!h) {
+		return 0;
+	}
+	h->size = size;
+	h->tag = tag;
+	h->magic = kMemBlockMagic;
+	h->reserved = 0;
+	memUpdateStats(tag, size, 1);
+	return h + 1;
+}
+
+void *memCalloc(int tag, int count, int size) {
+	void *p = memAlloc(tag, count * size);
+	if (p) {
+		memset(p, 0, count * size);
+	}
+	return p;
+}
+
+void *memRealloc(int tag, void *p, int size) {
+	if (!p) {
+		return memAlloc(tag, size);
+	}
+	MemBlockHeader *h = (MemBlockHeader *)p - 1;
+	assert(h->magic == kMemBlockMagic && (int)h->tag == tag);
+	const int prevSize = h->size;
+	h = (MemBlockHeader *)realloc(h, sizeof(MemBlockHeader) + size);
+	if (!h) {
+		return 0;
+	}
+	h->size = size;
+	memUpdateStats(tag, size - prevSize, 0);
+	return h + 1;
+}
+
+void memFree(void *p) {
+	if (p) {
+		MemBlockHeader *h = (MemBlockHeader *)p - 1;
+		assert(h->magic == kMemBlockMagic);
+		h->magic = 0;
+		memUpdateStats(h->tag, -(int64_t)h->size, -1);
+		free(h);
+	}
+}
+
+void memPrintStats(const char *title, bool resetPeaks) {
+	if ((g_utilDebugMask & kDebug_MEMORY) == 0) {
+		return;
+	}
+	int64_t totalBytes = 0, totalPeakBytes = 0;
+	fprintf(stdout, "memory %s\n", title);
+	for (int i = 0; i < kMemTagsCount; ++i) {
+		MemTagStats *ms = &_memTagStats[i];
+		const int64_t bytes = __atomic_load_n(&ms->bytes, __ATOMIC_RELAXED);
+		const int32_t blocks = __atomic_load_n(&ms->blocks, __ATOMIC_RELAXED);
+		const int64_t peakBytes = __atomic_load_n(&ms->peakBytes, __ATOMIC_RELAXED);
+		const int32_t peakBlocks = __atomic_load_n(&ms->peakBlocks, __ATOMIC_RELAXED);
+		fprintf(stdout, "  %-16s live %10.1f KB %7d blocks peak %10.1f KB %7d blocks\n", _memTagNames[i], bytes / 1024., blocks, peakBytes / 1024., peakBlocks);
+		totalBytes += bytes;
+		totalPeakBytes += peakBytes;
+		if (resetPeaks) {
+			__atomic_store_n(&ms->peakBytes, bytes, __ATOMIC_RELAXED);
+			__atomic_store_n(&ms->peakBlocks, blocks, __ATOMIC_RELAXED);
+		}
+	}
+	fprintf(stdout, "  %-16s live %10.1f KB peak %10.1f KB\n", "total", totalBytes / 1024., totalPeakBytes / 1024.);
+	fflush(stdout);
+}
+
 static const uint32_t t[256] = { // crc32
 	0x00000000, 0x77073096, 0xee0e612c, 0x990951ba, 0x076dc419, 0x706af48f, 0xe963a535, 0x9e6495a3,
 	0x0edb8832, 0x79dcb8a4, 0xe0d5e91e, 0x97d2d988, 0x09b64c2b, 0x7eb17cbd, 0xe7b82d07, 0x90bf1d91,
@@ -127,6 +245,22 @@ static const uint32_t t[256] = { // crc32
 	0xb3667a2e, 0xc4614ab8, 0x5d681b02, 0x2a6f2b94, 0xb40bbe37, 0xc30c8ea1, 0x5a05df1b, 0x2d02ef8d
 };
 
+uint64_t getTimeNs() {
+#ifdef _WIN32
+	static LARGE_INTEGER frequency;
+	if (frequency.QuadPart == 0) {
+		QueryPerformanceFrequency(&frequency);
+	}
+	LARGE_INTEGER counter;
+	QueryPerformanceCounter(&counter);
+	return (uint64_t)(counter.QuadPart / frequency.QuadPart) * 1000000000 + (uint64_t)(counter.QuadPart % frequency.QuadPart) * 1000000000 / frequency.QuadPart;
+#else
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+#endif
+}
+
 uint32_t getStringHash(const char *s) {
 	uint32_t hash = 0;
 	for (int i = 0; s[i]; ++i) {
@@ -22,7 +22,23 @@ enum {
 	kDebug_CUTSCENE = 1 << 4,
 	kDebug_OPCODES  = 1 << 5,
 	kDebug_SOUND    = 1 << 6,
-	kDebug_SAVELOAD = 1 << 7
+	kDebug_SAVELOAD = 1 << 7,
+	kDebug_MEMORY   = 1 << 8
+};
+
+enum {
+	kMemTag_RESOURCE = 0,
+	kMemTag_SPRITECACHE,
+	kMemTag_TEXTURE,
+	kMemTag_ATLAS,
+	kMemTag_MESSAGE,
+	kMemTag_COLLISION,
+	kMemTag_MIXER,
+	kMemTag_CUTSCENE,
+	kMemTag_GEOMETRY,
+	kMemTag_MESHCACHE,
+	kMemTag_RENDERJOBS,
+	kMemTagsCount
 };
 
 extern const char *g_caption;
@@ -36,8 +52,26 @@ void debug(int debugChannel, const char *msg, ...);
 void warning(const char *msg, ...);
 void error(const char *msg, ...);
 uint32_t getStringHash(const char *s);
+uint64_t getTimeNs();
 void saveBMP(const char *filepath, const uint8_t *rgb, int w, int h);
 
+// tagged allocations, blocks must be released with memFree
+void *memAlloc(int tag, int size);
+void *memCalloc(int tag, int count, int size);
+void *memRealloc(int tag, void *p, int size);
+void memFree(void *p);
+void memPrintStats(const char *title, bool resetPeaks);
+
+#define MEM_TAGGED_NEW(tag) \
+	static void *operator new(size_t size) { \
+		void *p = memAlloc(tag, size); \
+		if (!p) { \
+			error("Unable to allocate %d bytes", (int)size); \
+		} \
+		return p; \
+	} \
+	static void operator delete(void *p) { memFree(p); }
+
 #undef MIN
 template<typename T>
 inline T MIN(T v1, T v2) {
@@ -82,4 +116,10 @@ inline T *ALLOC(int count) {
 	return (T *)calloc(count, sizeof(T));
 }
 
+// released with memFree()
+template<typename T>
+inline T *ALLOC_TAGGED(int tag, int count) {
+	return (T *)memCalloc(tag, count, sizeof(T));
+}
+
 #endif // UTIL_H__